@@ -427,6 +427,28 @@ class UMaterial : public UMaterialInterface
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = ToonShader, meta = (editcondition = "bUseToonRendering"))
 	float ToonOutlineThickness;
 
+	/** Read toon color, shininess, outline color and outline thickness from the per instance custom data of instanced meshes. */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = ToonShader, meta = (editcondition = "bUseToonRendering"))
+	uint8 bUseToonInstanceCustomData : 1;
+
+	/** First of the 8 custom data floats: color rgb, shininess, outline color rgb, outline thickness. Instances with fewer floats keep the material values. */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = ToonShader, meta = (editcondition = "bUseToonRendering && bUseToonInstanceCustomData", ClampMin = "0", UIMin = "0"))
+	int32 ToonInstanceCustomDataIndex;
+
+	/**
+	 * Read the same 8 toon values from the custom primitive data of the component, instance custom data still wins.
+	 * Changing custom primitive data only re-uploads the primitive, so toon values can be animated without re-caching draw commands.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = ToonShader, meta = (editcondition = "bUseToonRendering"))
+	uint8 bUseToonPrimitiveCustomData : 1;
+
+	/**
+	 * First of the 8 custom primitive data floats, laid out like the instance custom data.
+	 * Custom primitive data that was never set reads as 0, so a shininess or outline thickness <= 0 keeps the material's color and shininess or outline color and thickness.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = ToonShader, meta = (editcondition = "bUseToonRendering && bUseToonPrimitiveCustomData", ClampMin = "0", ClampMax = "28", UIMin = "0", UIMax = "28"))
+	int32 ToonPrimitiveCustomDataIndex;
+
 
 #if WITH_EDITORONLY_DATA
 	ENGINE_API virtual const UClass* GetEditorOnlyDataClass() const override { return UMaterialEditorOnlyData::StaticClass(); }
@@ -1134,6 +1156,8 @@ public:
 	ENGINE_API virtual float GetToonShininess() const override;
 	ENGINE_API virtual FLinearColor GetToonOutlineColor() const override;
 	ENGINE_API virtual float GetToonOutlineThickness() const override;
+	ENGINE_API virtual int32 GetToonInstanceCustomDataIndex() const override;
+	ENGINE_API virtual int32 GetToonPrimitiveCustomDataIndex() const override;
 
 	ENGINE_API virtual FGraphEventArray PrecachePSOs(const FPSOPrecacheVertexFactoryDataList& VertexFactoryDataList, const FPSOPrecacheParams& PreCacheParams, EPSOPrecachePriority Priority, TArray<FMaterialPSOPrecacheRequestID>& OutMaterialPSORequestIDs) override;
 
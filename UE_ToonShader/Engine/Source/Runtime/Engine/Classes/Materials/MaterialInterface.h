@@ -897,6 +897,8 @@ public:
 	ENGINE_API virtual float GetToonShininess() const;
 	ENGINE_API virtual FLinearColor GetToonOutlineColor() const;
 	ENGINE_API virtual float GetToonOutlineThickness() const;
+	ENGINE_API virtual int32 GetToonInstanceCustomDataIndex() const;
+	ENGINE_API virtual int32 GetToonPrimitiveCustomDataIndex() const;
 
 	ENGINE_API virtual USubsurfaceProfile* GetSubsurfaceProfile_Internal() const;
 	ENGINE_API virtual bool CastsRayTracedShadows() const;
@@ -200,6 +200,16 @@ float FMaterialResource::GetToonOutlineThickness() const
 	return Material->GetToonOutlineThickness();
 }
 
+int32 FMaterialResource::GetToonInstanceCustomDataIndex() const
+{
+	return Material->GetToonInstanceCustomDataIndex();
+}
+
+int32 FMaterialResource::GetToonPrimitiveCustomDataIndex() const
+{
+	return Material->GetToonPrimitiveCustomDataIndex();
+}
+
 
 int32 FMaterialResource::CompilePropertyAndSetMaterialProperty(EMaterialProperty Property, FMaterialCompiler* Compiler, EShaderFrequency OverrideShaderFrequency, bool bUsePreviousFrameTime) const
 {
@@ -4568,6 +4578,18 @@ void UMaterial::PostEditChangePropertyInternal(FPropertyChangedEvent& PropertyCh
 		NaniteOverrideMaterial.PostEditChange();
 	}
 
+	// toon passes only draw non-nanite meshes, nanite meshes shade the material as a regular lit material.
+	// only warn when one of the properties deciding this changed, not on every edit
+	const FName MemberPropertyName = PropertyChangedEvent.MemberProperty ? PropertyChangedEvent.MemberProperty->GetFName() : NAME_None;
+	const bool bToonNanitePropertyChanged = MemberPropertyName == GET_MEMBER_NAME_CHECKED(UMaterial, bUseToonRendering)
+		|| MemberPropertyName == GET_MEMBER_NAME_CHECKED(UMaterial, bUsedWithNanite)
+		|| MemberPropertyName == GET_MEMBER_NAME_CHECKED(UMaterial, NaniteOverrideMaterial);
+
+	if (bToonNanitePropertyChanged && bUseToonRendering && bUsedWithNanite && !NaniteOverrideMaterial.GetOverrideMaterial())
+	{
+		UE_LOG(LogMaterial, Warning, TEXT("Material %s uses toon rendering, Nanite meshes will render it without toon shading or outline. Set a Nanite override material or disable Nanite on the mesh."), *GetPathName());
+	}
+
 	TranslucencyDirectionalLightingIntensity = FMath::Clamp(TranslucencyDirectionalLightingIntensity, .1f, 10.0f);
 
 	// Don't want to recompile after a duplicate because it's just been done by PostLoad, nor during interactive changes to prevent constant recompilation while spinning properties.
@@ -6532,6 +6554,17 @@ float UMaterial::GetToonOutlineThickness() const
 	return ToonOutlineThickness;
 }
 
+int32 UMaterial::GetToonInstanceCustomDataIndex() const
+{
+	return bUseToonInstanceCustomData ? ToonInstanceCustomDataIndex : INDEX_NONE;
+}
+
+int32 UMaterial::GetToonPrimitiveCustomDataIndex() const
+{
+	// NUM_CUSTOM_PRIMITIVE_DATA counts float4s, the 8 toon floats must fit in the primitive's custom data
+	return bUseToonPrimitiveCustomData ? FMath::Clamp(ToonPrimitiveCustomDataIndex, 0, NUM_CUSTOM_PRIMITIVE_DATA * 4 - 8) : INDEX_NONE;
+}
+
 
 void UMaterial::SetShadingModel(EMaterialShadingModel NewModel)
 {
@@ -1231,6 +1231,16 @@ float UMaterialInterface::GetToonOutlineThickness() const
 	return 0.0f;
 }
 
+int32 UMaterialInterface::GetToonInstanceCustomDataIndex() const
+{
+	return INDEX_NONE;
+}
+
+int32 UMaterialInterface::GetToonPrimitiveCustomDataIndex() const
+{
+	return INDEX_NONE;
+}
+
 
 bool UMaterialInterface::IsDeferredDecal() const
 {
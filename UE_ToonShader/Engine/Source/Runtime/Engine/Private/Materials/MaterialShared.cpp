@@ -59,6 +59,8 @@
 
 DEFINE_LOG_CATEGORY(LogMaterial);
 
+IMPLEMENT_GLOBAL_SHADER_PARAMETER_STRUCT(FToonMaterialParameters, "ToonMaterial");
+
 IMPLEMENT_TYPE_LAYOUT(FHashedMaterialParameterInfo);
 IMPLEMENT_TYPE_LAYOUT(FUniformExpressionSet);
 IMPLEMENT_TYPE_LAYOUT(FMaterialCompilationOutput);
@@ -2197,6 +2199,8 @@ void FMaterial::PrepareDestroy_RenderThread()
 {
 	check(IsInRenderingThread());
 
+	ToonUniformBuffer.SafeRelease();
+
 #if WITH_EDITOR
 	RenderingThreadCompilingShaderMapId = 0u;
 	RenderingThreadPendingCompilerEnvironment.SafeRelease();
@@ -2555,6 +2559,10 @@ bool FMaterial::CacheShaders(const FMaterialShaderMapId& ShaderMapId, EShaderPla
 	TRACE_CPUPROFILER_EVENT_SCOPE(FMaterial::CacheShaders);
 #endif
 	UE_CLOG(!ShaderMapId.IsValid(), LogMaterial, Warning, TEXT("Invalid shader map ID caching shaders for '%s', will use default material."), *GetFriendlyName());
+
+	// queued before any shader map reaches the rendering thread, so toon shaders always find their buffer
+	UpdateToonUniformBuffer();
+
 #if WITH_EDITOR
 	FString DDCKeyHash;
 
@@ -4877,6 +4885,48 @@ float FMaterial::GetToonOutlineThickness() const
 	return 0.0f;
 }
 
+int32 FMaterial::GetToonInstanceCustomDataIndex() const
+{
+	return INDEX_NONE;
+}
+
+int32 FMaterial::GetToonPrimitiveCustomDataIndex() const
+{
+	return INDEX_NONE;
+}
+
+void FMaterial::UpdateToonUniformBuffer()
+{
+	checkSlow(IsInGameThread() || IsInAsyncLoadingThread());
+
+	if (!UseToonRendering())
+	{
+		return;
+	}
+
+	FToonMaterialParameters Parameters;
+	Parameters.Color = GetToonColor();
+	Parameters.OutlineColor = GetToonOutlineColor();
+	Parameters.Shininess = GetToonShininess();
+	Parameters.OutlineThickness = GetToonOutlineThickness();
+	Parameters.InstanceCustomDataIndex = GetToonInstanceCustomDataIndex();
+	Parameters.PrimitiveCustomDataIndex = GetToonPrimitiveCustomDataIndex();
+
+	TRefCountPtr<FMaterial> Material = this;
+	ENQUEUE_RENDER_COMMAND(UpdateToonUniformBuffer)([Material = MoveTemp(Material), Parameters](FRHICommandListImmediate& RHICmdList) mutable
+	{
+		// cached mesh draw commands reference the buffer, so it is updated in place once created
+		if (Material->ToonUniformBuffer.IsValid())
+		{
+			Material->ToonUniformBuffer.UpdateUniformBufferImmediate(Parameters);
+		}
+		else
+		{
+			Material->ToonUniformBuffer = TUniformBufferRef<FToonMaterialParameters>::CreateUniformBufferImmediate(Parameters, UniformBuffer_MultiFrame);
+		}
+	});
+}
+
 void FMaterial::SetShaderMapsOnMaterialResources(const TMap<TRefCountPtr<FMaterial>, TRefCountPtr<FMaterialShaderMap>>& MaterialsToUpdate)
 {
 	for (const auto& It : MaterialsToUpdate)
@@ -1629,6 +1629,16 @@ extern ENGINE_API void GetMaterialValueTypeDescriptions(const uint32 MaterialVal
 /** Check whether a combination of EMaterialValueType flags can be connected */
 extern ENGINE_API bool CanConnectMaterialValueTypes(const uint32 InputType, const uint32 OutputType);
 
+/** toon values of a material, bound by the toon mesh pass shaders as ToonMaterial */
+BEGIN_GLOBAL_SHADER_PARAMETER_STRUCT(FToonMaterialParameters, ENGINE_API)
+	SHADER_PARAMETER(FLinearColor, Color)
+	SHADER_PARAMETER(FLinearColor, OutlineColor)
+	SHADER_PARAMETER(float, Shininess)
+	SHADER_PARAMETER(float, OutlineThickness)
+	SHADER_PARAMETER(int32, InstanceCustomDataIndex)
+	SHADER_PARAMETER(int32, PrimitiveCustomDataIndex)
+END_GLOBAL_SHADER_PARAMETER_STRUCT()
+
 /**
  * FMaterial serves 3 intertwined purposes:
  *   Represents a material to the material compilation process, and provides hooks for extensibility (CompileProperty, etc)
@@ -1656,6 +1666,14 @@ public:
 	ENGINE_API virtual float GetToonShininess() const;
 	ENGINE_API virtual FLinearColor GetToonOutlineColor() const;
 	ENGINE_API virtual float GetToonOutlineThickness() const;
+	ENGINE_API virtual int32 GetToonInstanceCustomDataIndex() const;
+	ENGINE_API virtual int32 GetToonPrimitiveCustomDataIndex() const;
+
+	/** Reads the toon values on the game thread and creates or updates the toon uniform buffer on the rendering thread. */
+	ENGINE_API void UpdateToonUniformBuffer();
+
+	/** Toon uniform buffer bound by the toon mesh pass shaders, null for non-toon materials. Rendering thread only. */
+	FRHIUniformBuffer* GetToonUniformBuffer() const { return ToonUniformBuffer.GetReference(); }
 
 	/** Sets shader maps on the specified materials without blocking. */
 	ENGINE_API static void SetShaderMapsOnMaterialResources(const TMap<TRefCountPtr<FMaterial>, TRefCountPtr<FMaterialShaderMap>>& MaterialsToUpdate);
@@ -2430,6 +2448,9 @@ private:
 	/** Shared critical section on PrecachedPSORequestIDs because contention should be very limited */
 	static FCriticalSection PrecachedPSORequestIDsCS;
 
+	/** Toon values of this material, only touched on the rendering thread. */
+	TUniformBufferRef<FToonMaterialParameters> ToonUniformBuffer;
+
 #if WITH_EDITOR
 	/**
 	* Compiles this material for Platform, storing the result in OutShaderMap if the compile was synchronous
@@ -2504,6 +2525,8 @@ public:
 	ENGINE_API virtual float GetToonShininess() const override;
 	ENGINE_API virtual FLinearColor GetToonOutlineColor() const override;
 	ENGINE_API virtual float GetToonOutlineThickness() const override;
+	ENGINE_API virtual int32 GetToonInstanceCustomDataIndex() const override;
+	ENGINE_API virtual int32 GetToonPrimitiveCustomDataIndex() const override;
 
 
 	void SetMaterial(UMaterial* InMaterial, UMaterialInstance* InInstance, ERHIFeatureLevel::Type InFeatureLevel, EMaterialQualityLevel::Type InQualityLevel = EMaterialQualityLevel::Num)
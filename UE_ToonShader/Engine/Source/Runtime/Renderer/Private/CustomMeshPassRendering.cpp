@@ -23,6 +23,177 @@
 #include "RenderCore.h"
 #include "DataDrivenShaderPlatformInfo.h"
 #include "VolumetricFog.h"
+#include "LightRendering.h"
+#include "SystemTextures.h"
+
+
+/** toon mesh sorting */
+
+static TAutoConsoleVariable<int32> CVarToonFrontToBackSort(
+	TEXT("r.Toon.FrontToBackSort"),
+	0,
+	TEXT("Whether toon pass draws are ordered coarsely front to back so early depth testing rejects hidden toon pixels.\n")
+	TEXT(" 0: order by shaders only (default)\n")
+	TEXT(" 1: order by depth bucket, then by shaders within a bucket"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarToonOutlineFrontToBackSort(
+	TEXT("r.Toon.Outline.FrontToBackSort"),
+	0,
+	TEXT("Same as r.Toon.FrontToBackSort for the toon outline pass."),
+	ECVF_RenderThreadSafe);
+
+FMeshDrawCommandSortKey GetToonMeshSortKey(const FMeshMaterialShader* VertexShader, const FMeshMaterialShader* PixelShader)
+{
+	FMeshDrawCommandSortKey SortKey;
+	SortKey.Toon.VertexShaderHash = (VertexShader ? VertexShader->GetSortKey() : 0) & 0xFFFF;
+	SortKey.Toon.PixelShaderHash = PixelShader ? PixelShader->GetSortKey() : 0;
+	SortKey.Toon.DepthBucket = 0;
+	return SortKey;
+}
+
+bool ShouldSortToonMeshesFrontToBack(EMeshPass::Type MeshPass)
+{
+	switch (MeshPass)
+	{
+	case EMeshPass::ToonPass:
+		return CVarToonFrontToBackSort.GetValueOnAnyThread() != 0;
+	case EMeshPass::ToonOutlinePass:
+		return CVarToonOutlineFrontToBackSort.GetValueOnAnyThread() != 0;
+	default:
+		return false;
+	}
+}
+
+uint16 GetToonMeshDepthBucket(const FVector& ViewOrigin, const FBoxSphereBounds& Bounds)
+{
+	// distance to the closest point of the bounding sphere, primitives around the camera sort first
+	const float Distance = (float)FMath::Max((Bounds.Origin - ViewOrigin).Size() - Bounds.SphereRadius, 0.0);
+
+	// the float bits of a positive value grow with it, keeping the exponent and 3 mantissa bits gives buckets about 12% deep
+	union { float F; uint32 I; } DistanceBits;
+	DistanceBits.F = Distance;
+
+	return (uint16)FMath::Min<uint32>(DistanceBits.I >> 20, 0xFFFF);
+}
+
+void UpdateToonMeshSortKeys(const FViewInfo& View, const FScene& Scene, FViewCommands& ViewCommands)
+{
+	const FVector ViewOrigin = View.ViewMatrices.GetViewOrigin();
+
+	for (EMeshPass::Type MeshPass : { EMeshPass::ToonPass, EMeshPass::ToonOutlinePass })
+	{
+		if (!ShouldSortToonMeshesFrontToBack(MeshPass))
+		{
+			continue;
+		}
+
+		// only the visible copies change, the cached commands keep their shader only key
+		for (FVisibleMeshDrawCommand& VisibleMeshDrawCommand : ViewCommands.MeshCommands[MeshPass])
+		{
+			const int32 PrimitiveIndex = VisibleMeshDrawCommand.PrimitiveIdInfo.ScenePrimitiveId;
+
+			if (Scene.PrimitiveBounds.IsValidIndex(PrimitiveIndex))
+			{
+				VisibleMeshDrawCommand.SortKey.Toon.DepthBucket = GetToonMeshDepthBucket(ViewOrigin, Scene.PrimitiveBounds[PrimitiveIndex].BoxSphereBounds);
+			}
+		}
+	}
+}
+
+
+/** parallel toon pass recording */
+
+static TAutoConsoleVariable<int32> CVarToonParallelPass(
+	TEXT("r.Toon.ParallelPass"),
+	1,
+	TEXT("Whether the toon passes translate their mesh draw commands on parallel command lists, like r.ParallelBasePass.\n")
+	TEXT(" 0: record all toon draws on the render thread\n")
+	TEXT(" 1: record toon draws in parallel when the RHI supports parallel command lists (default)"),
+	ECVF_RenderThreadSafe);
+
+DECLARE_CYCLE_STAT(TEXT("ToonPass"), STAT_CLP_ToonPass, STATGROUP_ParallelCommandListMarkers);
+
+static bool IsParallelToonPassEnabled()
+{
+	return GRHICommandList.UseParallelAlgorithms() && CVarToonParallelPass.GetValueOnRenderThread() != 0;
+}
+
+
+/** compact toon attributes */
+
+static TAutoConsoleVariable<int32> CVarToonCompactAttributes(
+	TEXT("r.Toon.CompactAttributes"),
+	0,
+	TEXT("Whether the toon pass writes the normal, color and shininess of toon pixels to a compact target read by toon lighting in a single load.\n")
+	TEXT("The target is only allocated when toon meshes are visible. Read only as the choice is baked into cached toon mesh draw commands.\n")
+	TEXT(" 0: toon lighting reads the toon values from GBufferA, GBufferC and GBufferD (default)\n")
+	TEXT(" 1: toon lighting reads them from the compact toon attributes target, GBufferD is left untouched by the toon pass.\n")
+	TEXT("    GBuffer layouts without a free target after the seven toon targets keep using GBufferD"),
+	ECVF_ReadOnly | ECVF_RenderThreadSafe);
+
+static const ETextureCreateFlags ToonAttributesCreateFlags = TexCreate_RenderTargetable | TexCreate_ShaderResource;
+
+bool IsToonCompactAttributesEnabled()
+{
+	return CVarToonCompactAttributes.GetValueOnAnyThread() != 0;
+}
+
+bool ShouldWriteToonCompactAttributes(uint32 GBufferTargetCount)
+{
+	// the toon shader writes the attributes to a fixed slot, it must be the first one after the GBuffer targets
+	return IsToonCompactAttributesEnabled() && GBufferTargetCount == ToonAttributesTargetIndex;
+}
+
+// base pass targets of a scene textures config, the GBuffer layout only depends on the shader platform
+static uint32 GetToonGBufferTargetCount(const FSceneTexturesConfig& SceneTexturesConfig)
+{
+	FGraphicsPipelineRenderTargetsInfo RenderTargetsInfo;
+	SetupGBufferRenderTargetInfo(SceneTexturesConfig, RenderTargetsInfo, false);
+	return RenderTargetsInfo.RenderTargetsEnabled;
+}
+
+bool ShouldWriteToonCompactAttributes(ERHIFeatureLevel::Type FeatureLevel)
+{
+	if (!IsToonCompactAttributesEnabled())
+	{
+		return false;
+	}
+
+	// FSceneTexturesConfig::Get() follows the last rendered scene, a default config of the feature level has the same GBuffer layout whenever it is built
+	FSceneTexturesConfigInitSettings InitSettings;
+	InitSettings.FeatureLevel = FeatureLevel;
+
+	FSceneTexturesConfig SceneTexturesConfig;
+	SceneTexturesConfig.Init(InitSettings);
+
+	return ShouldWriteToonCompactAttributes(GetToonGBufferTargetCount(SceneTexturesConfig));
+}
+
+// the compact toon attributes follow the GBuffer targets in the binding shared by the toon mesh passes
+static bool AddToonAttributesRenderTargetInfo(FGraphicsPipelineRenderTargetsInfo& RenderTargetsInfo)
+{
+	if (!ShouldWriteToonCompactAttributes(RenderTargetsInfo.RenderTargetsEnabled))
+	{
+		return false;
+	}
+
+	AddRenderTargetInfo(ToonAttributesFormat, ToonAttributesCreateFlags, RenderTargetsInfo);
+	return true;
+}
+
+
+/** depth state shared by the toon passes */
+
+// the toon passes draw right after the base pass, depth is read only when the depth prepass has every opaque mesh.
+// cached mesh draw commands are built with this access, so RenderToonMeshPasses binds it as well instead of the per frame base pass access
+static FExclusiveDepthStencil::Type GetToonPassDepthStencilAccess(const FScene* Scene, ERHIFeatureLevel::Type FeatureLevel)
+{
+	return Scene ? Scene->DefaultBasePassDepthStencilAccess : FScene::GetDefaultBasePassDepthStencilAccess(FeatureLevel);
+}
+
+// the outline shell lies outside the prepass depth, it always writes depth so later passes like fog see the outline instead of the background
+static constexpr FExclusiveDepthStencil::Type ToonOutlinePassDepthStencilAccess = FExclusiveDepthStencil::DepthWrite_StencilWrite;
 
 
 /** toon outline pass */
@@ -31,6 +202,32 @@ IMPLEMENT_MATERIAL_SHADER_TYPE(, FToonOutlineShaderVS, TEXT("/Engine/Private/Too
 IMPLEMENT_MATERIAL_SHADER_TYPE(, FToonOutlineShaderPS, TEXT("/Engine/Private/ToonOutlineMeshPassShader.usf"), TEXT("MainPS"), SF_Pixel);
 IMPLEMENT_SHADERPIPELINE_TYPE_VSPS(ToonOutlineShaderPipeline, FToonOutlineShaderVS, FToonOutlineShaderPS, true);
 
+// shared by Process and CollectPSOInitializers so precached PSOs match the drawn ones
+static FMeshPassProcessorRenderState GetToonOutlinePassRenderState()
+{
+	FMeshPassProcessorRenderState RenderState;
+
+	// the outline shader writes scene color, GBufferA, GBufferC and velocity, the remaining GBuffer targets of the shared binding are masked
+	RenderState.SetBlendState(TStaticBlendStateWriteMask<CW_RGBA, CW_RGBA, CW_NONE, CW_RGBA, CW_RGBA, CW_NONE, CW_NONE, CW_NONE>::GetRHI());
+	RenderState.SetDepthStencilState(TStaticDepthStencilState<true, CF_Always>::GetRHI());
+	return RenderState;
+}
+
+static bool GetToonOutlinePassShaders(const FMaterial& Material, const FVertexFactoryType* VertexFactoryType, TMeshProcessorShaders<FToonOutlineShaderVS, FToonOutlineShaderPS>& Shaders)
+{
+	FMaterialShaderTypes ShaderTypes;
+	ShaderTypes.AddShaderType<FToonOutlineShaderVS>();
+	ShaderTypes.AddShaderType<FToonOutlineShaderPS>();
+	FMaterialShaders MaterialShaders;
+	if (!Material.TryGetShaders(ShaderTypes, VertexFactoryType, MaterialShaders))
+	{
+		return false;
+	}
+	MaterialShaders.TryGetVertexShader(Shaders.VertexShader);
+	MaterialShaders.TryGetPixelShader(Shaders.PixelShader);
+	return true;
+}
+
 void FToonOutlinePassProcessor::AddMeshBatch(const FMeshBatch& RESTRICT MeshBatch, uint64 BatchElementMask, const FPrimitiveSceneProxy* RESTRICT PrimitiveSceneProxy, int32 StaticMeshId)
 {
 	const FMaterialRenderProxy* MaterialRenderProxy = MeshBatch.MaterialRenderProxy;
@@ -58,24 +255,21 @@ bool FToonOutlinePassProcessor::Process(
 	ERasterizerCullMode MeshCullMode)
 {
 	// pso에 포함되는 정보
-	FMeshPassProcessorRenderState RenderState;
-	RenderState.SetBlendState(TStaticBlendState<>::GetRHI());
-	RenderState.SetDepthStencilState(TStaticDepthStencilState<true, CF_Always>::GetRHI());
+	FMeshPassProcessorRenderState RenderState = GetToonOutlinePassRenderState();
 
 	// get shaders
 	TMeshProcessorShaders<FToonOutlineShaderVS, FToonOutlineShaderPS> Shaders;
-	FMaterialShaderTypes ShaderTypes;
-	ShaderTypes.AddShaderType<FToonOutlineShaderVS>();
-	ShaderTypes.AddShaderType<FToonOutlineShaderPS>();
-	FMaterialShaders MaterialShaders;
-	if (!MaterialResource.TryGetShaders(ShaderTypes, MeshBatch.VertexFactory->GetType(), MaterialShaders))
+	if (!GetToonOutlinePassShaders(MaterialResource, MeshBatch.VertexFactory->GetType(), Shaders))
 		return false;
-	MaterialShaders.TryGetVertexShader(Shaders.VertexShader);
-	MaterialShaders.TryGetPixelShader(Shaders.PixelShader);
 
 	// sort key
-	FMeshDrawCommandSortKey SortKey = FMeshDrawCommandSortKey::Default;
-	SortKey = CalculateMeshStaticSortKey(Shaders.VertexShader.GetShader(), Shaders.PixelShader.GetShader());
+	FMeshDrawCommandSortKey SortKey = GetToonMeshSortKey(Shaders.VertexShader.GetShader(), Shaders.PixelShader.GetShader());
+
+	// dynamic commands are built for one view, so their depth bucket is known here
+	if (ViewIfDynamicMeshCommand && PrimitiveSceneProxy && ShouldSortToonMeshesFrontToBack(MeshPassType))
+	{
+		SortKey.Toon.DepthBucket = GetToonMeshDepthBucket(ViewIfDynamicMeshCommand->ViewMatrices.GetViewOrigin(), PrimitiveSceneProxy->GetBounds());
+	}
 
 
 	// c++ FMeshMaterialShader로 이동해서 GetShaderBindings()에 입력되는 데이터
@@ -100,93 +294,100 @@ bool FToonOutlinePassProcessor::Process(
 	return true;
 }
 
-FMeshPassProcessor* CreateToonOutlinePassProcessor(ERHIFeatureLevel::Type FeatureLevel, const FScene* Scene, const FSceneView* InViewIfDynamicMeshCommand, FMeshPassDrawListContext* InDrawListContext)
+void FToonOutlinePassProcessor::CollectPSOInitializers(const FSceneTexturesConfig& SceneTexturesConfig, const FMaterial& Material, const FPSOPrecacheVertexFactoryData& VertexFactoryData, const FPSOPrecacheParams& PreCacheParams, TArray<FPSOPrecacheData>& PSOInitializers)
 {
-	return new FToonOutlinePassProcessor(EMeshPass::ToonOutlinePass, Scene, FeatureLevel, InViewIfDynamicMeshCommand, true,
-		EDepthDrawingMode::DDM_AllOpaque, true, true, InDrawListContext);
-}
-
-REGISTER_MESHPASSPROCESSOR_AND_PSOCOLLECTOR(ToonOutlinePass, CreateToonOutlinePassProcessor, EShadingPath::Deferred, EMeshPass::ToonOutlinePass, EMeshPassFlags::CachedMeshCommands | EMeshPassFlags::MainView);
-
-
+	if (!Material.UseToonRendering())
+	{
+		return;
+	}
 
-BEGIN_SHADER_PARAMETER_STRUCT(FToonOutlinePassParameters, )
-	SHADER_PARAMETER_RDG_UNIFORM_BUFFER(FDeferredLightUniformStruct, DeferredLight)
-	SHADER_PARAMETER_STRUCT_INCLUDE(FViewShaderParameters, View)
-	SHADER_PARAMETER_STRUCT_INCLUDE(FInstanceCullingDrawParams, InstanceCullingDrawParams)
-	RENDER_TARGET_BINDING_SLOTS()
-END_SHADER_PARAMETER_STRUCT()
+	const FMeshDrawingPolicyOverrideSettings OverrideSettings = ComputeMeshOverrideSettings(PreCacheParams);
+	const ERasterizerFillMode MeshFillMode = ComputeMeshFillMode(Material, OverrideSettings);
+	const ERasterizerCullMode MeshCullMode = ComputeMeshCullMode(Material, OverrideSettings);
 
+	TMeshProcessorShaders<FToonOutlineShaderVS, FToonOutlineShaderPS> Shaders;
+	if (!GetToonOutlinePassShaders(Material, VertexFactoryData.VertexFactoryType, Shaders))
+	{
+		return;
+	}
 
-FToonOutlinePassParameters* GetToonOutlinePassParameters(FRDGBuilder& GraphBuilder, const FViewInfo& View, const FRenderTargetBindingSlots& BasePassRenderTargets)
-{
-	auto* PassParameters = GraphBuilder.AllocParameters<FToonOutlinePassParameters>();
-	PassParameters->View = View.GetShaderParameters();
-	PassParameters->RenderTargets = BasePassRenderTargets;
-	return PassParameters;
+	// the outline pass draws into the base pass GBuffer and depth
+	FGraphicsPipelineRenderTargetsInfo RenderTargetsInfo;
+	RenderTargetsInfo.NumSamples = 1;
+	SetupGBufferRenderTargetInfo(SceneTexturesConfig, RenderTargetsInfo, true);
+	AddToonAttributesRenderTargetInfo(RenderTargetsInfo);
+	RenderTargetsInfo.DepthStencilAccess = ToonOutlinePassDepthStencilAccess;
+
+	AddGraphicsPipelineStateInitializer(
+		VertexFactoryData,
+		Material,
+		GetToonOutlinePassRenderState(),
+		RenderTargetsInfo,
+		Shaders,
+		MeshFillMode,
+		MeshCullMode,
+		(EPrimitiveType)PreCacheParams.PrimitiveType,
+		EMeshPassFeatures::Default,
+		true /*bRequired*/,
+		PSOInitializers);
 }
 
-void FDeferredShadingSceneRenderer::RenderToonOutlinePass(
-	FRDGBuilder& GraphBuilder,
-	FInstanceCullingManager& InstanceCullingManager,
-	FSortedLightSetSceneInfo& SortedLightSet,
-	FSceneTextures& SceneTextures,
-	FExclusiveDepthStencil::Type BasePassDepthStencilAccess)
+FMeshPassProcessor* CreateToonOutlinePassProcessor(ERHIFeatureLevel::Type FeatureLevel, const FScene* Scene, const FSceneView* InViewIfDynamicMeshCommand, FMeshPassDrawListContext* InDrawListContext)
 {
-	RDG_EVENT_SCOPE(GraphBuilder, "ToonOutlinePass");
-	RDG_CSV_STAT_EXCLUSIVE_SCOPE(GraphBuilder, RenderToonOutlinePass);
+	return new FToonOutlinePassProcessor(EMeshPass::ToonOutlinePass, Scene, FeatureLevel, InViewIfDynamicMeshCommand, true,
+		EDepthDrawingMode::DDM_AllOpaque, true, true, InDrawListContext);
+}
 
+REGISTER_MESHPASSPROCESSOR_AND_PSOCOLLECTOR(ToonOutlinePass, CreateToonOutlinePassProcessor, EShadingPath::Deferred, EMeshPass::ToonOutlinePass, EMeshPassFlags::CachedMeshCommands | EMeshPassFlags::MainView);
 
 
-	TStaticArray<FTextureRenderTargetBinding, MaxSimultaneousRenderTargets> BasePassTextures;
-	uint32 BasePassTextureCount = SceneTextures.GetGBufferRenderTargets(BasePassTextures);
-	TArrayView<FTextureRenderTargetBinding> BasePassTexturesView = MakeArrayView(BasePassTextures.GetData(), BasePassTextureCount);
-	const FExclusiveDepthStencil ExclusiveDepthStencil(BasePassDepthStencilAccess);
-	FRDGTextureRef BasePassDepthTexture = SceneTextures.Depth.Target;
 
-	FRenderTargetBindingSlots BasePassRenderTargets = GetRenderTargetBindings(ERenderTargetLoadAction::ELoad, BasePassTexturesView);
-	BasePassRenderTargets.DepthStencil = FDepthStencilBinding(BasePassDepthTexture, ERenderTargetLoadAction::ELoad, ERenderTargetLoadAction::ELoad, ExclusiveDepthStencil);
+/** toon shader pass */
 
+static FMeshPassProcessorRenderState GetToonPassRenderState(FExclusiveDepthStencil::Type DepthStencilAccess, bool bWriteCompactAttributes)
+{
+	FMeshPassProcessorRenderState RenderState;
 
-	for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ++ViewIndex)
+	// with the compact toon attributes the toon values go to their own target instead of GBufferD
+	if (bWriteCompactAttributes)
 	{
-		FViewInfo& View = Views[ViewIndex];
-		RDG_GPU_MASK_SCOPE(GraphBuilder, View.GPUMask);
-		RDG_EVENT_SCOPE_CONDITIONAL(GraphBuilder, Views.Num() > 1, "View%d", ViewIndex);
-
-		const bool bShouldRenderView = View.ShouldRenderView();
-
-		if (bShouldRenderView)
-		{
-			View.BeginRenderView();
-
-			FToonOutlinePassParameters* PassParameters = GetToonOutlinePassParameters(GraphBuilder, View, BasePassRenderTargets);
-
-			View.ParallelMeshDrawCommandPasses[EMeshPass::ToonOutlinePass].BuildRenderingCommands(GraphBuilder, Scene->GPUScene, PassParameters->InstanceCullingDrawParams);
-
-			GraphBuilder.AddPass(
-				RDG_EVENT_NAME("ToonOutlinePass"),
-				PassParameters,
-				ERDGPassFlags::Raster,
-				[this, &View, PassParameters](FRHICommandList& RHICmdList)
-			{
-				SetStereoViewport(RHICmdList, View, 1.0f);
-				View.ParallelMeshDrawCommandPasses[EMeshPass::ToonOutlinePass].DispatchDraw(nullptr, RHICmdList, &PassParameters->InstanceCullingDrawParams);
-			});
-		}
+		RenderState.SetBlendState(TStaticBlendStateWriteMask<CW_RGBA, CW_RGBA, CW_RGBA, CW_RGBA, CW_RGBA, CW_NONE, CW_RGBA, CW_RGBA>::GetRHI());
+	}
+	else
+	{
+		RenderState.SetBlendState(TStaticBlendStateWriteMask<CW_RGBA, CW_RGBA, CW_RGBA, CW_RGBA, CW_RGBA, CW_RGBA, CW_RGBA, CW_NONE>::GetRHI());
 	}
 
+	// with a full depth prepass only the visible surface passes the test, so each toon pixel is shaded once whatever the draw order.
+	// toon pixels are tagged in stencil by TagToonStencil, the stencil clear after the decals would drop a tag written here
+	if (FExclusiveDepthStencil(DepthStencilAccess).IsDepthWrite())
+	{
+		RenderState.SetDepthStencilState(TStaticDepthStencilState<true, CF_DepthNearOrEqual>::GetRHI());
+	}
+	else
+	{
+		RenderState.SetDepthStencilState(TStaticDepthStencilState<false, CF_DepthNearOrEqual>::GetRHI());
+	}
+	return RenderState;
 }
 
+static bool GetToonPassShaders(const FMaterial& Material, const FVertexFactoryType* VertexFactoryType, bool bWriteCompactAttributes, TMeshProcessorShaders<FToonShaderVS, FToonShaderPS>& Shaders)
+{
+	FToonShaderPS::FPermutationDomain PermutationVector;
+	PermutationVector.Set<FToonShaderPS::FCompactAttributesDim>(bWriteCompactAttributes);
 
-
-
-
-
-
-
-
-/** toon shader pass */
+	FMaterialShaderTypes ShaderTypes;
+	ShaderTypes.AddShaderType<FToonShaderVS>();
+	ShaderTypes.AddShaderType<FToonShaderPS>(PermutationVector.ToDimensionValueId());
+	FMaterialShaders MaterialShaders;
+	if (!Material.TryGetShaders(ShaderTypes, VertexFactoryType, MaterialShaders))
+	{
+		return false;
+	}
+	MaterialShaders.TryGetVertexShader(Shaders.VertexShader);
+	MaterialShaders.TryGetPixelShader(Shaders.PixelShader);
+	return true;
+}
 
 void FToonPassProcessor::AddMeshBatch(const FMeshBatch& RESTRICT MeshBatch, uint64 BatchElementMask, const FPrimitiveSceneProxy* RESTRICT PrimitiveSceneProxy, int32 StaticMeshId)
 {
@@ -215,24 +416,21 @@ bool FToonPassProcessor::Process(
 	ERasterizerCullMode MeshCullMode)
 {
 	// pso에 포함되는 정보
-	FMeshPassProcessorRenderState RenderState;
-	RenderState.SetBlendState(TStaticBlendState<>::GetRHI());
-	RenderState.SetDepthStencilState(TStaticDepthStencilState<true,CF_DepthNearOrEqual>::GetRHI());
+	FMeshPassProcessorRenderState RenderState = GetToonPassRenderState(GetToonPassDepthStencilAccess(Scene, FeatureLevel), bWriteCompactAttributes);
 
 	// get shaders
 	TMeshProcessorShaders<FToonShaderVS,FToonShaderPS> Shaders;
-	FMaterialShaderTypes ShaderTypes;
-	ShaderTypes.AddShaderType<FToonShaderVS>();
-	ShaderTypes.AddShaderType<FToonShaderPS>();
-	FMaterialShaders MaterialShaders;
-	if (!MaterialResource.TryGetShaders(ShaderTypes, MeshBatch.VertexFactory->GetType(), MaterialShaders))
+	if (!GetToonPassShaders(MaterialResource, MeshBatch.VertexFactory->GetType(), bWriteCompactAttributes, Shaders))
 		return false;
-	MaterialShaders.TryGetVertexShader(Shaders.VertexShader);
-	MaterialShaders.TryGetPixelShader(Shaders.PixelShader);
 
 	// sort key
-	FMeshDrawCommandSortKey SortKey = FMeshDrawCommandSortKey::Default;
-	SortKey = CalculateMeshStaticSortKey(Shaders.VertexShader.GetShader(), Shaders.PixelShader.GetShader());
+	FMeshDrawCommandSortKey SortKey = GetToonMeshSortKey(Shaders.VertexShader.GetShader(), Shaders.PixelShader.GetShader());
+
+	// dynamic commands are built for one view, so their depth bucket is known here
+	if (ViewIfDynamicMeshCommand && PrimitiveSceneProxy && ShouldSortToonMeshesFrontToBack(MeshPassType))
+	{
+		SortKey.Toon.DepthBucket = GetToonMeshDepthBucket(ViewIfDynamicMeshCommand->ViewMatrices.GetViewOrigin(), PrimitiveSceneProxy->GetBounds());
+	}
 
 
 	// c++ FMeshMaterialShader로 이동해서 GetShaderBindings()에 입력되는 데이터
@@ -257,6 +455,46 @@ bool FToonPassProcessor::Process(
 	return true;
 }
 
+void FToonPassProcessor::CollectPSOInitializers(const FSceneTexturesConfig& SceneTexturesConfig, const FMaterial& Material, const FPSOPrecacheVertexFactoryData& VertexFactoryData, const FPSOPrecacheParams& PreCacheParams, TArray<FPSOPrecacheData>& PSOInitializers)
+{
+	if (!Material.UseToonRendering())
+	{
+		return;
+	}
+
+	const FMeshDrawingPolicyOverrideSettings OverrideSettings = ComputeMeshOverrideSettings(PreCacheParams);
+	const ERasterizerFillMode MeshFillMode = ComputeMeshFillMode(Material, OverrideSettings);
+	const ERasterizerCullMode MeshCullMode = ComputeMeshCullMode(Material, OverrideSettings);
+
+	const FExclusiveDepthStencil::Type DepthStencilAccess = GetToonPassDepthStencilAccess(Scene, FeatureLevel);
+
+	// same targets as the base pass, the toon pass writes the GBuffer of toon meshes
+	FGraphicsPipelineRenderTargetsInfo RenderTargetsInfo;
+	RenderTargetsInfo.NumSamples = 1;
+	SetupGBufferRenderTargetInfo(SceneTexturesConfig, RenderTargetsInfo, true);
+	const bool bPrecacheCompactAttributes = AddToonAttributesRenderTargetInfo(RenderTargetsInfo);
+	RenderTargetsInfo.DepthStencilAccess = DepthStencilAccess;
+
+	TMeshProcessorShaders<FToonShaderVS, FToonShaderPS> Shaders;
+	if (!GetToonPassShaders(Material, VertexFactoryData.VertexFactoryType, bPrecacheCompactAttributes, Shaders))
+	{
+		return;
+	}
+
+	AddGraphicsPipelineStateInitializer(
+		VertexFactoryData,
+		Material,
+		GetToonPassRenderState(DepthStencilAccess, bPrecacheCompactAttributes),
+		RenderTargetsInfo,
+		Shaders,
+		MeshFillMode,
+		MeshCullMode,
+		(EPrimitiveType)PreCacheParams.PrimitiveType,
+		EMeshPassFeatures::Default,
+		true /*bRequired*/,
+		PSOInitializers);
+}
+
 FMeshPassProcessor* CreateToonPassProcessor(ERHIFeatureLevel::Type FeatureLevel, const FScene* Scene, const FSceneView* InViewIfDynamicMeshCommand, FMeshPassDrawListContext* InDrawListContext)
 {
 	return new FToonPassProcessor(EMeshPass::ToonPass, Scene, FeatureLevel, InViewIfDynamicMeshCommand, true,
@@ -272,40 +510,132 @@ IMPLEMENT_SHADERPIPELINE_TYPE_VSPS(ToonShaderPipeline, FToonShaderVS, FToonShade
 
 
 
-BEGIN_SHADER_PARAMETER_STRUCT(FToonPassParameters, )
-	SHADER_PARAMETER_RDG_UNIFORM_BUFFER(FDeferredLightUniformStruct, DeferredLight)
+/** toon mesh passes */
+
+IMPLEMENT_STATIC_UNIFORM_BUFFER_STRUCT(FToonPassUniformParameters, "ToonPass", SceneTextures);
+
+BEGIN_SHADER_PARAMETER_STRUCT(FToonMeshPassParameters, )
 	SHADER_PARAMETER_STRUCT_INCLUDE(FViewShaderParameters, View)
-	SHADER_PARAMETER_STRUCT_INCLUDE(FInstanceCullingDrawParams, InstanceCullingDrawParams)
+	SHADER_PARAMETER_RDG_UNIFORM_BUFFER(FToonPassUniformParameters, ToonPass)
+	SHADER_PARAMETER_STRUCT(FInstanceCullingDrawParams, OutlineInstanceCullingDrawParams)
+	SHADER_PARAMETER_STRUCT(FInstanceCullingDrawParams, InstanceCullingDrawParams)
 	RENDER_TARGET_BINDING_SLOTS()
 END_SHADER_PARAMETER_STRUCT()
 
 
-FToonPassParameters* GetToonPassParameters(FRDGBuilder& GraphBuilder, const FViewInfo& View, const FRenderTargetBindingSlots& BasePassRenderTargets )
+FToonMeshPassParameters* GetToonMeshPassParameters(
+	FRDGBuilder& GraphBuilder,
+	const FViewInfo& View,
+	TRDGUniformBufferRef<FToonPassUniformParameters> ToonPassUniformBuffer,
+	const FRenderTargetBindingSlots& BasePassRenderTargets)
 {
-	auto* PassParameters = GraphBuilder.AllocParameters<FToonPassParameters>();
+	auto* PassParameters = GraphBuilder.AllocParameters<FToonMeshPassParameters>();
 	PassParameters->View = View.GetShaderParameters();
+	PassParameters->ToonPass = ToonPassUniformBuffer;
 	PassParameters->RenderTargets = BasePassRenderTargets;
 	return PassParameters;
 }
 
-void FDeferredShadingSceneRenderer::RenderToonPass(
+/** draws the outline and/or the toon mesh pass of a view in one raster pass over PassParameters' binding, outlines first */
+static void AddToonMeshPass(
+	FRDGBuilder& GraphBuilder,
+	FViewInfo& View,
+	FToonMeshPassParameters* PassParameters,
+	bool bParallelToonPass,
+	bool bDrawOutlines,
+	bool bDrawToonMeshes)
+{
+	if (bParallelToonPass)
+	{
+		// the render pass is begun by each parallel command list, so it is skipped on the parent list
+		GraphBuilder.AddPass(
+			RDG_EVENT_NAME("ToonPassParallel"),
+			PassParameters,
+			ERDGPassFlags::Raster | ERDGPassFlags::SkipRenderPass,
+			[&View, PassParameters, bDrawOutlines, bDrawToonMeshes](const FRDGPass* InPass, FRHICommandListImmediate& RHICmdList)
+		{
+			FRDGParallelCommandListSet ParallelCommandListSet(InPass, RHICmdList, GET_STATID(STAT_CLP_ToonPass), View, FParallelCommandListBindings(PassParameters));
+			if (bDrawOutlines)
+			{
+				View.ParallelMeshDrawCommandPasses[EMeshPass::ToonOutlinePass].DispatchDraw(&ParallelCommandListSet, RHICmdList, &PassParameters->OutlineInstanceCullingDrawParams);
+			}
+			if (bDrawToonMeshes)
+			{
+				View.ParallelMeshDrawCommandPasses[EMeshPass::ToonPass].DispatchDraw(&ParallelCommandListSet, RHICmdList, &PassParameters->InstanceCullingDrawParams);
+			}
+		});
+	}
+	else
+	{
+		GraphBuilder.AddPass(
+			RDG_EVENT_NAME("ToonPass"),
+			PassParameters,
+			ERDGPassFlags::Raster,
+			[&View, PassParameters, bDrawOutlines, bDrawToonMeshes](FRHICommandList& RHICmdList)
+		{
+			SetStereoViewport(RHICmdList, View, 1.0f);
+			if (bDrawOutlines)
+			{
+				View.ParallelMeshDrawCommandPasses[EMeshPass::ToonOutlinePass].DispatchDraw(nullptr, RHICmdList, &PassParameters->OutlineInstanceCullingDrawParams);
+			}
+			if (bDrawToonMeshes)
+			{
+				View.ParallelMeshDrawCommandPasses[EMeshPass::ToonPass].DispatchDraw(nullptr, RHICmdList, &PassParameters->InstanceCullingDrawParams);
+			}
+		});
+	}
+}
+
+void FDeferredShadingSceneRenderer::RenderToonMeshPasses(
 	FRDGBuilder& GraphBuilder,
 	FInstanceCullingManager& InstanceCullingManager,
 	FSortedLightSetSceneInfo& SortedLightSet,
 	FSceneTextures& SceneTextures,
-	FExclusiveDepthStencil::Type BasePassDepthStencilAccess)
+	const FDBufferTextures& DBufferTextures)
 {
+	ToonAttributesTexture = nullptr;
+
+	if (!HasAnyVisibleToonMeshes())
+	{
+		return;
+	}
+
 	RDG_EVENT_SCOPE(GraphBuilder, "ToonPass");
-	RDG_CSV_STAT_EXCLUSIVE_SCOPE(GraphBuilder, RenderToonPass);
+	RDG_CSV_STAT_EXCLUSIVE_SCOPE(GraphBuilder, RenderToonMeshPasses);
 
 	TStaticArray<FTextureRenderTargetBinding, MaxSimultaneousRenderTargets> BasePassTextures;
 	uint32 BasePassTextureCount = SceneTextures.GetGBufferRenderTargets(BasePassTextures);
 	TArrayView<FTextureRenderTargetBinding> BasePassTexturesView = MakeArrayView(BasePassTextures.GetData(), BasePassTextureCount);
-	const FExclusiveDepthStencil ExclusiveDepthStencil(BasePassDepthStencilAccess);
+	const FExclusiveDepthStencil ExclusiveDepthStencil(GetToonPassDepthStencilAccess(Scene, FeatureLevel));
 	FRDGTextureRef BasePassDepthTexture = SceneTextures.Depth.Target;
 
+	// one binding for both mesh passes, the GBuffer is loaded and stored once per view.
+	// when the toon pass only reads depth, the outlines get their own pass with a depth write binding
 	FRenderTargetBindingSlots BasePassRenderTargets = GetRenderTargetBindings(ERenderTargetLoadAction::ELoad, BasePassTexturesView);
 	BasePassRenderTargets.DepthStencil = FDepthStencilBinding(BasePassDepthTexture, ERenderTargetLoadAction::ELoad, ERenderTargetLoadAction::ELoad, ExclusiveDepthStencil);
+	const bool bSeparateOutlinePass = !ExclusiveDepthStencil.IsDepthWrite();
+
+	// the cached toon pass blend state made the same choice, so GBufferD is written whenever the attributes are not
+	if (ShouldWriteToonCompactAttributes(FeatureLevel))
+	{
+		check(BasePassTextureCount == ToonAttributesTargetIndex);
+
+		const FRDGTextureDesc Desc = FRDGTextureDesc::Create2D(SceneTextures.Config.Extent, ToonAttributesFormat, FClearValueBinding::Black, ToonAttributesCreateFlags);
+		ToonAttributesTexture = GraphBuilder.CreateTexture(Desc, TEXT("Toon.Attributes"));
+
+		// cleared in its own pass, the parallel toon pass begins the render pass once per command list
+		AddClearRenderTargetPass(GraphBuilder, ToonAttributesTexture);
+		BasePassRenderTargets[BasePassTextureCount] = FRenderTargetBinding(ToonAttributesTexture, ERenderTargetLoadAction::ELoad);
+	}
+
+	// the toon pass applies the DBuffer decals of toon meshes, the dummy reads as a pixel no decal covers
+	const FRDGSystemTextures& SystemTextures = FRDGSystemTextures::Get(GraphBuilder);
+	FToonPassUniformParameters* ToonPassParameters = GraphBuilder.AllocParameters<FToonPassUniformParameters>();
+	ToonPassParameters->DBufferATexture = DBufferTextures.IsValid() ? DBufferTextures.DBufferA : SystemTextures.BlackAlphaOne;
+	ToonPassParameters->DBufferBTexture = DBufferTextures.IsValid() ? DBufferTextures.DBufferB : SystemTextures.BlackAlphaOne;
+	TRDGUniformBufferRef<FToonPassUniformParameters> ToonPassUniformBuffer = GraphBuilder.CreateUniformBuffer(ToonPassParameters);
+
+	const bool bParallelToonPass = IsParallelToonPassEnabled();
 
 	for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ++ViewIndex)
 	{
@@ -313,34 +643,73 @@ void FDeferredShadingSceneRenderer::RenderToonPass(
 		RDG_GPU_MASK_SCOPE(GraphBuilder, View.GPUMask);
 		RDG_EVENT_SCOPE_CONDITIONAL(GraphBuilder, Views.Num() > 1, "View%d", ViewIndex);
 
-		const bool bShouldRenderView = View.ShouldRenderView();
+		FParallelMeshDrawCommandPass& OutlinePass = View.ParallelMeshDrawCommandPasses[EMeshPass::ToonOutlinePass];
+		FParallelMeshDrawCommandPass& ToonPass = View.ParallelMeshDrawCommandPasses[EMeshPass::ToonPass];
+
+		const bool bShouldRenderView = View.ShouldRenderView() && (OutlinePass.HasAnyDraw() || ToonPass.HasAnyDraw());
 
 		if (bShouldRenderView)
 		{
 			View.BeginRenderView();
 
-			FToonPassParameters* PassParameters = GetToonPassParameters(GraphBuilder, View, BasePassRenderTargets);
+			FToonMeshPassParameters* PassParameters = GetToonMeshPassParameters(GraphBuilder, View, ToonPassUniformBuffer, BasePassRenderTargets);
 
-			View.ParallelMeshDrawCommandPasses[EMeshPass::ToonPass].BuildRenderingCommands(GraphBuilder, Scene->GPUScene, PassParameters->InstanceCullingDrawParams);
+			// instance culling is inherited from the MainView pass setup (SetupMeshPass in SceneRendering.cpp)
+			ToonPass.BuildRenderingCommands(GraphBuilder, Scene->GPUScene, PassParameters->InstanceCullingDrawParams);
 
-			GraphBuilder.AddPass(
-				RDG_EVENT_NAME("ToonPass"),
-				PassParameters,
-				ERDGPassFlags::Raster,
-				[this, &View, PassParameters](FRHICommandList& RHICmdList)
+			// outlines first, the fill then draws over the inner shell of the outline
+			if (bSeparateOutlinePass)
 			{
-				SetStereoViewport(RHICmdList, View, 1.0f);
-				View.ParallelMeshDrawCommandPasses[EMeshPass::ToonPass].DispatchDraw(nullptr, RHICmdList, &PassParameters->InstanceCullingDrawParams);
-			});
+				FToonMeshPassParameters* OutlinePassParameters = GetToonMeshPassParameters(GraphBuilder, View, ToonPassUniformBuffer, BasePassRenderTargets);
+				OutlinePassParameters->RenderTargets.DepthStencil = FDepthStencilBinding(BasePassDepthTexture, ERenderTargetLoadAction::ELoad, ERenderTargetLoadAction::ELoad, ToonOutlinePassDepthStencilAccess);
+				OutlinePass.BuildRenderingCommands(GraphBuilder, Scene->GPUScene, OutlinePassParameters->OutlineInstanceCullingDrawParams);
+
+				AddToonMeshPass(GraphBuilder, View, OutlinePassParameters, bParallelToonPass, true, false);
+				AddToonMeshPass(GraphBuilder, View, PassParameters, bParallelToonPass, false, true);
+			}
+			else
+			{
+				OutlinePass.BuildRenderingCommands(GraphBuilder, Scene->GPUScene, PassParameters->OutlineInstanceCullingDrawParams);
+
+				AddToonMeshPass(GraphBuilder, View, PassParameters, bParallelToonPass, true, true);
+			}
 		}
 	}
-
 }
 
 
 
 /** Toon lighting shader*/
 
+static TAutoConsoleVariable<int32> CVarToonClusteredLighting(
+	TEXT("r.Toon.ClusteredLighting"),
+	1,
+	TEXT("Whether to shade toon pixels for all lights in the light grid with a single pass per view.\n")
+	TEXT(" 0: one toon lighting pass per light\n")
+	TEXT(" 1: one clustered toon lighting pass per view, lights outside the clustered range still get a pass each (default)"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarToonTileClassification(
+	TEXT("r.Toon.TileClassification"),
+	1,
+	TEXT("Whether toon lighting only draws over the screen tiles that contain toon pixels.\n")
+	TEXT(" 0: full screen quad per toon lighting pass\n")
+	TEXT(" 1: indirect draw over the tiles classified after the toon pass (default)"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarToonLightCulling(
+	TEXT("r.Toon.LightCulling"),
+	1,
+	TEXT("Whether local lights that reach no visible toon primitive are dropped before their toon lighting pass is added.\n")
+	TEXT(" 0: every light gets a toon lighting pass\n")
+	TEXT(" 1: cull local lights against the visible toon primitives they interact with (default)"),
+	ECVF_RenderThreadSafe);
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Toon lights culled"), STAT_ToonLightsCulled, STATGROUP_LightRendering);
+
+/** size in pixels of the screen tiles classified for toon lighting, must match TOON_TILE_SIZE in the shaders */
+static constexpr int32 ToonTileSize = 8;
+
 class FToonLightShaderVS : public FGlobalShader
 {
 	DECLARE_SHADER_TYPE(FToonLightShaderVS, Global);
@@ -358,6 +727,7 @@ public:
 	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
 	{
 		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("TOON_TILE_SIZE"), ToonTileSize);
 	}
 
 };
@@ -370,14 +740,22 @@ class FToonLightShaderPS : public FGlobalShader
 	SHADER_USE_PARAMETER_STRUCT(FToonLightShaderPS, FGlobalShader);
 
 
+	class FClusteredLightsDim : SHADER_PERMUTATION_BOOL("TOON_CLUSTERED_LIGHTS");
+	class FRadialLightDim : SHADER_PERMUTATION_BOOL("TOON_RADIAL_LIGHT");
+	class FSimpleLightsDim : SHADER_PERMUTATION_BOOL("TOON_SIMPLE_LIGHTS");
+	class FVirtualShadowMapMaskDim : SHADER_PERMUTATION_BOOL("TOON_VIRTUAL_SHADOW_MAP_MASK");
+	class FCompactAttributesDim : SHADER_PERMUTATION_BOOL("TOON_COMPACT_ATTRIBUTES");
+	using FPermutationDomain = TShaderPermutationDomain<FClusteredLightsDim, FRadialLightDim, FSimpleLightsDim, FVirtualShadowMapMaskDim, FCompactAttributesDim>;
+
 	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
 		SHADER_PARAMETER_RDG_UNIFORM_BUFFER(FSceneTextureUniformParameters, SceneTextures)
 		SHADER_PARAMETER_RDG_UNIFORM_BUFFER(FForwardLightData, ForwardLightData)
+		SHADER_PARAMETER_RDG_BUFFER_SRV(Buffer<float4>, ToonSimpleLights)
 		SHADER_PARAMETER_RDG_TEXTURE(Texture2D, LightAttenuationTexture)
-		SHADER_PARAMETER_SAMPLER(SamplerState, LightAttenuationTextureSampler)
-		SHADER_PARAMETER_RDG_TEXTURE(Texture2D, LightingChannelsTexture)
-		SHADER_PARAMETER_SAMPLER(SamplerState, LightingChannelsSampler)
-		SHADER_PARAMETER_RDG_TEXTURE(Texture2D, ScreenShadowMaskSubPixelTexture)
+		SHADER_PARAMETER_RDG_UNIFORM_BUFFER(FVirtualShadowMapUniformParameters, VirtualShadowMap)
+		SHADER_PARAMETER(int32, VirtualShadowMapId)
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D, ShadowMaskBits)
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D<uint2>, ToonAttributesTexture)
 		SHADER_PARAMETER_STRUCT_REF(FViewUniformShaderParameters, View)
 		SHADER_PARAMETER_RDG_UNIFORM_BUFFER(FDeferredLightUniformStruct, DeferredLight)
 		RENDER_TARGET_BINDING_SLOTS()
@@ -385,75 +763,228 @@ class FToonLightShaderPS : public FGlobalShader
 
 public:
 
-
-	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
 	{
-		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
-	}
-};
+		FPermutationDomain PermutationVector(Parameters.PermutationId);
 
+		// clustered, radial and simple lights each have their own path
+		const int32 NumLightPaths =
+			(PermutationVector.Get<FClusteredLightsDim>() ? 1 : 0) +
+			(PermutationVector.Get<FRadialLightDim>() ? 1 : 0) +
+			(PermutationVector.Get<FSimpleLightsDim>() ? 1 : 0);
 
+		if (NumLightPaths > 1)
+		{
+			return false;
+		}
 
-IMPLEMENT_GLOBAL_SHADER(FToonLightShaderVS, "/Engine/Private/ToonLightingShader.usf", "MainVS", SF_Vertex);
-IMPLEMENT_GLOBAL_SHADER(FToonLightShaderPS, "/Engine/Private/ToonLightingShader.usf", "MainPS", SF_Pixel);
+		// the packed mask bits only store local lights, drawn alone or from the light grid
+		if (PermutationVector.Get<FVirtualShadowMapMaskDim>())
+		{
+			return (PermutationVector.Get<FRadialLightDim>() || PermutationVector.Get<FClusteredLightsDim>()) && DoesPlatformSupportVirtualShadowMaps(Parameters.Platform);
+		}
+
+		return true;
+	}
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("TOON_TILE_SIZE"), ToonTileSize);
+	}
+};
+
+
+
+class FToonLightTileVS : public FGlobalShader
+{
+	DECLARE_SHADER_TYPE(FToonLightTileVS, Global);
+
+	SHADER_USE_PARAMETER_STRUCT(FToonLightTileVS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_STRUCT_INCLUDE(FViewShaderParameters, View)
+		SHADER_PARAMETER_RDG_BUFFER_SRV(Buffer<uint>, ToonTileList)
+		SHADER_PARAMETER(uint32, ToonTileEyeMask)
+		SHADER_PARAMETER(FVector4f, ToonViewportMinAndInvSize)
+		END_SHADER_PARAMETER_STRUCT()
+
+public:
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("TOON_TILE_SIZE"), ToonTileSize);
+	}
+};
+
+
+class FToonSimpleLightVS : public FGlobalShader
+{
+	DECLARE_SHADER_TYPE(FToonSimpleLightVS, Global);
+
+	SHADER_USE_PARAMETER_STRUCT(FToonSimpleLightVS, FGlobalShader);
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_STRUCT_REF(FViewUniformShaderParameters, View)
+		SHADER_PARAMETER_RDG_BUFFER_SRV(Buffer<float4>, ToonSimpleLights)
+		END_SHADER_PARAMETER_STRUCT()
+
+public:
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("TOON_TILE_SIZE"), ToonTileSize);
+	}
+};
+
+
+class FToonTileClassificationCS : public FGlobalShader
+{
+	DECLARE_SHADER_TYPE(FToonTileClassificationCS, Global);
+
+	SHADER_USE_PARAMETER_STRUCT(FToonTileClassificationCS, FGlobalShader);
+
+	class FCompactAttributesDim : SHADER_PERMUTATION_BOOL("TOON_COMPACT_ATTRIBUTES");
+	using FPermutationDomain = TShaderPermutationDomain<FCompactAttributesDim>;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_STRUCT_INCLUDE(FViewShaderParameters, View)
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D, ToonMaskTexture)
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D<uint2>, ToonAttributesTexture)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, RWToonTileList)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, RWTileIndirectArgs)
+		END_SHADER_PARAMETER_STRUCT()
+
+public:
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("TOON_TILE_SIZE"), ToonTileSize);
+	}
+};
+
+
+class FToonStencilTagPS : public FGlobalShader
+{
+	DECLARE_SHADER_TYPE(FToonStencilTagPS, Global);
+
+	SHADER_USE_PARAMETER_STRUCT(FToonStencilTagPS, FGlobalShader);
+
+	class FCompactAttributesDim : SHADER_PERMUTATION_BOOL("TOON_COMPACT_ATTRIBUTES");
+	using FPermutationDomain = TShaderPermutationDomain<FCompactAttributesDim>;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D, ToonMaskTexture)
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D<uint2>, ToonAttributesTexture)
+		END_SHADER_PARAMETER_STRUCT()
+
+public:
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("TOON_TILE_SIZE"), ToonTileSize);
+	}
+};
+
+
+
+IMPLEMENT_GLOBAL_SHADER(FToonLightShaderVS, "/Engine/Private/ToonLightingShader.usf", "MainVS", SF_Vertex);
+IMPLEMENT_GLOBAL_SHADER(FToonLightShaderPS, "/Engine/Private/ToonLightingShader.usf", "MainPS", SF_Pixel);
+IMPLEMENT_GLOBAL_SHADER(FToonLightTileVS, "/Engine/Private/ToonLightingShader.usf", "TileVS", SF_Vertex);
+IMPLEMENT_GLOBAL_SHADER(FToonSimpleLightVS, "/Engine/Private/ToonLightingShader.usf", "SimpleLightVS", SF_Vertex);
+IMPLEMENT_GLOBAL_SHADER(FToonTileClassificationCS, "/Engine/Private/ToonTileClassification.usf", "ClassifyToonTilesCS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FToonStencilTagPS, "/Engine/Private/ToonTileClassification.usf", "TagToonStencilPS", SF_Pixel);
 
 
 BEGIN_SHADER_PARAMETER_STRUCT(FToonLightingParameters, )
 	SHADER_PARAMETER_STRUCT_INCLUDE(FToonLightShaderVS::FParameters, VS)
+	SHADER_PARAMETER_STRUCT_INCLUDE(FToonLightTileVS::FParameters, TileVS)
+	SHADER_PARAMETER_STRUCT_INCLUDE(FDeferredLightVS::FParameters, RadialVS)
+	SHADER_PARAMETER_STRUCT_INCLUDE(FToonSimpleLightVS::FParameters, SimpleLightVS)
 	SHADER_PARAMETER_STRUCT_INCLUDE(FToonLightShaderPS::FParameters, PS)
+	RDG_BUFFER_ACCESS(TileIndirectArgs, ERHIAccess::IndirectArgs)
 END_SHADER_PARAMETER_STRUCT()
 
 
-
-static void RenderToonLight_Internal(
-	FRDGBuilder& GraphBuilder,
-	const FScene* Scene,
-	const FViewInfo& View,
-	const FLightSceneInfo* LightSceneInfo,
+/** EyeMask selects the eyes of the tile list that are drawn, ViewportRect is the rect the draw covers */
+static void SetToonLightTileParameters(
 	FToonLightingParameters* PassParameters,
-	const TCHAR* ShaderName)
+	const FViewInfo& View,
+	const FToonLightTiles* Tiles,
+	uint32 EyeMask,
+	const FIntRect& ViewportRect)
 {
-	const FLightSceneProxy* RESTRICT LightProxy = LightSceneInfo->Proxy;
-	const bool bTransmission = LightProxy->Transmission();
-	const FSphere LightBounds = LightProxy->GetBoundingSphere();
-	const ELightComponentType LightType = (ELightComponentType)LightProxy->GetLightType();
-
-	GraphBuilder.AddPass(
-		RDG_EVENT_NAME("%s", ShaderName),
-		PassParameters,
-		ERDGPassFlags::Raster,
-		[Scene, &View, LightSceneInfo, PassParameters, LightBounds, LightType](FRHICommandList& RHICmdList)
+	if (Tiles)
 	{
+		PassParameters->TileVS.View = View.GetShaderParameters();
+		PassParameters->TileVS.ToonTileList = Tiles->TileList;
+		PassParameters->TileVS.ToonTileEyeMask = EyeMask;
+		PassParameters->TileVS.ToonViewportMinAndInvSize = FVector4f(
+			ViewportRect.Min.X, ViewportRect.Min.Y,
+			1.0f / ViewportRect.Width(), 1.0f / ViewportRect.Height());
+		PassParameters->TileIndirectArgs = Tiles->TileIndirectArgs;
+	}
+}
 
-		const bool bIsRadial = LightType != LightType_Directional;
+// draws over the classified toon tiles when the view has them, otherwise over the whole view rect
+static void DrawToonLight(
+	FRHICommandList& RHICmdList,
+	const FViewInfo& View,
+	const FIntRect& ViewportRect,
+	const TShaderMapRef<FToonLightShaderPS>& PixelShader,
+	const FToonLightingParameters* PassParameters)
+{
+	FGraphicsPipelineStateInitializer GraphicsPSOInit;
+	RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
+	// Set the device viewport, spans both eyes when the tiles of an instanced stereo pair are drawn together
+	RHICmdList.SetViewport(ViewportRect.Min.X, ViewportRect.Min.Y, 0.0f, ViewportRect.Max.X, ViewportRect.Max.Y, 1.0f);
+
+	
+	GraphicsPSOInit.BlendState = TStaticBlendState<CW_RGBA, BO_Add, BF_One, BF_One, BO_Add, BF_One, BF_One>::GetRHI();
+	
+	GraphicsPSOInit.PrimitiveType = PT_TriangleList;
+
+	// Turn DBT back off
+	GraphicsPSOInit.bDepthBounds = false;
+	GraphicsPSOInit.RasterizerState = TStaticRasterizerState<FM_Solid, CM_None>::GetRHI();
+	GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PixelShader.GetPixelShader();
+	// only pixels tagged by TagToonStencil pass the stencil test
+	GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<
+		false, CF_Always,
+		true, CF_Equal, SO_Keep, SO_Keep, SO_Keep,
+		false, CF_Always, SO_Keep, SO_Keep, SO_Keep,
+		STENCIL_TOON_MASK, 0x00>::GetRHI();
+
+	if (PassParameters->TileIndirectArgs)
+	{
+		TShaderMapRef<FToonLightTileVS> VertexShader(View.ShaderMap);
 
-		FGraphicsPipelineStateInitializer GraphicsPSOInit;
-		RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
-		// Set the device viewport for the view.
-		RHICmdList.SetViewport(View.ViewRect.Min.X, View.ViewRect.Min.Y, 0.0f, View.ViewRect.Max.X, View.ViewRect.Max.Y, 1.0f);
+		GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = GEmptyVertexDeclaration.VertexDeclarationRHI;
+		GraphicsPSOInit.BoundShaderState.VertexShaderRHI = VertexShader.GetVertexShader();
+		SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit, STENCIL_TOON_MASK);
 
-		
-		GraphicsPSOInit.BlendState = TStaticBlendState<CW_RGBA, BO_Add, BF_One, BF_One, BO_Add, BF_One, BF_One>::GetRHI();
-		
-		GraphicsPSOInit.PrimitiveType = PT_TriangleList;
+		SetShaderParameters(RHICmdList, PixelShader, PixelShader.GetPixelShader(), PassParameters->PS);
+		SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), PassParameters->TileVS);
 
+		// Apply the light to the toon tiles only
+		RHICmdList.DrawPrimitiveIndirect(PassParameters->TileIndirectArgs->GetIndirectRHICallBuffer(), 0);
+	}
+	else
+	{
 		TShaderMapRef<FToonLightShaderVS> VertexShader(View.ShaderMap);
-		TShaderMapRef<FToonLightShaderPS> PixelShader(View.ShaderMap);
 
-		// Turn DBT back off
-		GraphicsPSOInit.bDepthBounds = false;
-		GraphicsPSOInit.RasterizerState = TStaticRasterizerState<FM_Solid, CM_None>::GetRHI();
 		GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = GFilterVertexDeclaration.VertexDeclarationRHI;
 		GraphicsPSOInit.BoundShaderState.VertexShaderRHI = VertexShader.GetVertexShader();
-		GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PixelShader.GetPixelShader();
-		GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CF_Always>::GetRHI();
-		SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit, 0x0);
+		SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit, STENCIL_TOON_MASK);
 
 		SetShaderParameters(RHICmdList, PixelShader, PixelShader.GetPixelShader(), PassParameters->PS);
-		//FToonLightShaderVS::FParameters VSParameters = FToonLightShaderVS::GetParameters(View);
 		SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), PassParameters->VS);
 
-		// Apply the directional light as a full screen quad
+		// Apply the light as a full screen quad
 		DrawRectangle(
 			RHICmdList,
 			0, 0,
@@ -464,6 +995,136 @@ static void RenderToonLight_Internal(
 			View.GetSceneTexturesConfig().Extent,
 			VertexShader,
 			EDRF_Default);
+	}
+}
+
+/** Sets up rasterizer and depth state for the light volume of a radial toon light, keeping the toon stencil test */
+static void SetToonBoundingGeometryRasterizerAndDepthState(FGraphicsPipelineStateInitializer& GraphicsPSOInit, const FViewInfo& View, bool bCameraInsideLightGeometry)
+{
+	if (bCameraInsideLightGeometry)
+	{
+		// Render backfaces with depth tests disabled since the camera is inside (or close to inside) the light geometry
+		GraphicsPSOInit.RasterizerState = View.bReverseCulling ? TStaticRasterizerState<FM_Solid, CM_CW>::GetRHI() : TStaticRasterizerState<FM_Solid, CM_CCW>::GetRHI();
+		GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<
+			false, CF_Always,
+			true, CF_Equal, SO_Keep, SO_Keep, SO_Keep,
+			false, CF_Always, SO_Keep, SO_Keep, SO_Keep,
+			STENCIL_TOON_MASK, 0x00>::GetRHI();
+	}
+	else
+	{
+		// Render frontfaces with depth tests on to get the speedup from HiZ since the camera is outside the light geometry
+		GraphicsPSOInit.RasterizerState = View.bReverseCulling ? TStaticRasterizerState<FM_Solid, CM_CCW>::GetRHI() : TStaticRasterizerState<FM_Solid, CM_CW>::GetRHI();
+		GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<
+			false, CF_DepthNearOrEqual,
+			true, CF_Equal, SO_Keep, SO_Keep, SO_Keep,
+			false, CF_Always, SO_Keep, SO_Keep, SO_Keep,
+			STENCIL_TOON_MASK, 0x00>::GetRHI();
+	}
+}
+
+// draws the sphere or cone bounding the light so only toon pixels inside its influence are shaded
+static void DrawToonRadialLight(
+	FRHICommandList& RHICmdList,
+	const FViewInfo& View,
+	const TShaderMapRef<FToonLightShaderPS>& PixelShader,
+	const FToonLightingParameters* PassParameters,
+	const FSphere& LightBounds,
+	ELightComponentType LightType)
+{
+	FGraphicsPipelineStateInitializer GraphicsPSOInit;
+	RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
+	// Set the device viewport for the view.
+	RHICmdList.SetViewport(View.ViewRect.Min.X, View.ViewRect.Min.Y, 0.0f, View.ViewRect.Max.X, View.ViewRect.Max.Y, 1.0f);
+
+	GraphicsPSOInit.BlendState = TStaticBlendState<CW_RGBA, BO_Add, BF_One, BF_One, BO_Add, BF_One, BF_One>::GetRHI();
+	GraphicsPSOInit.PrimitiveType = PT_TriangleList;
+	GraphicsPSOInit.bDepthBounds = GSupportsDepthBoundsTest && GAllowDepthBoundsTest != 0;
+
+	FDeferredLightVS::FPermutationDomain PermutationVectorVS;
+	PermutationVectorVS.Set<FDeferredLightVS::FRadialLight>(true);
+	TShaderMapRef<FDeferredLightVS> VertexShader(View.ShaderMap, PermutationVectorVS);
+
+	const bool bCameraInsideLightGeometry = ((FVector)View.ViewMatrices.GetViewOrigin() - LightBounds.Center).SizeSquared() < FMath::Square(LightBounds.W * 1.05f + View.NearClippingDistance * 2.0f)
+		// Always draw backfaces in ortho
+		|| !View.IsPerspectiveProjection();
+
+	SetToonBoundingGeometryRasterizerAndDepthState(GraphicsPSOInit, View, bCameraInsideLightGeometry);
+	GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = GetVertexDeclarationFVector4();
+	GraphicsPSOInit.BoundShaderState.VertexShaderRHI = VertexShader.GetVertexShader();
+	GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PixelShader.GetPixelShader();
+	SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit, STENCIL_TOON_MASK);
+
+	SetShaderParameters(RHICmdList, PixelShader, PixelShader.GetPixelShader(), PassParameters->PS);
+	SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), PassParameters->RadialVS);
+
+	if (GraphicsPSOInit.bDepthBounds)
+	{
+		// skip toon pixels whose depth is outside the light's bounding sphere
+		float NearDepth = 1.f;
+		float FarDepth = 0.f;
+		CalculateLightNearFarDepthFromBounds(View, LightBounds, NearDepth, FarDepth);
+		if (NearDepth <= FarDepth)
+		{
+			NearDepth = 1.0f;
+			FarDepth = 0.0f;
+		}
+
+		// UE uses reversed depth, so far < near
+		RHICmdList.SetDepthBounds(FarDepth, NearDepth);
+	}
+
+	if (LightType == LightType_Point || LightType == LightType_Rect)
+	{
+		StencilingGeometry::DrawSphere(RHICmdList);
+	}
+	else if (LightType == LightType_Spot)
+	{
+		StencilingGeometry::DrawCone(RHICmdList);
+	}
+}
+
+static void RenderToonLight_Internal(
+	FRDGBuilder& GraphBuilder,
+	const FScene* Scene,
+	const FViewInfo& View,
+	const FLightSceneInfo* LightSceneInfo,
+	const FIntRect& ViewportRect,
+	FToonLightingParameters* PassParameters,
+	const TCHAR* ShaderName)
+{
+	const FLightSceneProxy* RESTRICT LightProxy = LightSceneInfo->Proxy;
+	const bool bTransmission = LightProxy->Transmission();
+	const FSphere LightBounds = LightProxy->GetBoundingSphere();
+	const ELightComponentType LightType = (ELightComponentType)LightProxy->GetLightType();
+
+	const bool bIsRadial = LightType != LightType_Directional;
+	const bool bUseVirtualShadowMapMask = PassParameters->PS.VirtualShadowMapId != INDEX_NONE;
+
+	check(!bUseVirtualShadowMapMask || bIsRadial);		// VSM mask only stores local lights
+
+	FToonLightShaderPS::FPermutationDomain PermutationVector;
+	PermutationVector.Set<FToonLightShaderPS::FClusteredLightsDim>(false);
+	PermutationVector.Set<FToonLightShaderPS::FRadialLightDim>(bIsRadial);
+	PermutationVector.Set<FToonLightShaderPS::FSimpleLightsDim>(false);
+	PermutationVector.Set<FToonLightShaderPS::FVirtualShadowMapMaskDim>(bUseVirtualShadowMapMask);
+	PermutationVector.Set<FToonLightShaderPS::FCompactAttributesDim>(PassParameters->PS.ToonAttributesTexture != nullptr);
+	TShaderMapRef<FToonLightShaderPS> PixelShader(View.ShaderMap, PermutationVector);
+
+	GraphBuilder.AddPass(
+		RDG_EVENT_NAME("%s", ShaderName),
+		PassParameters,
+		ERDGPassFlags::Raster,
+		[Scene, &View, ViewportRect, LightSceneInfo, PixelShader, PassParameters, LightBounds, LightType, bIsRadial](FRHICommandList& RHICmdList)
+	{
+		if (bIsRadial)
+		{
+			DrawToonRadialLight(RHICmdList, View, PixelShader, PassParameters, LightBounds, LightType);
+		}
+		else
+		{
+			DrawToonLight(RHICmdList, View, ViewportRect, PixelShader, PassParameters);
+		}
 	}); // RenderPass
 }
 
@@ -473,18 +1134,614 @@ void FDeferredShadingSceneRenderer::RenderToonLight(
 	const FViewInfo& View,
 	const FMinimalSceneTextures& SceneTextures,
 	const FLightSceneInfo* LightSceneInfo,
-	const TCHAR* ShaderName)
+	FRDGTextureRef ScreenShadowMaskTexture,
+	const TCHAR* ShaderName,
+	TRDGUniformBufferRef<FVirtualShadowMapUniformParameters> VirtualShadowMapUniformBuffer,
+	FRDGTextureRef ShadowMaskBits,
+	int32 VirtualShadowMapId)
 {
+	const bool bIsDirectional = LightSceneInfo->Proxy->GetLightType() == LightType_Directional;
+
+	uint32 EyeIndex = 0;
+	const FToonLightTiles* Tiles = GetToonLightTiles(View, EyeIndex);
+
+	uint32 EyeMask = 1u << EyeIndex;
+	FIntRect ViewportRect = View.ViewRect;
+
+	if (bIsDirectional && Tiles && Tiles->NumEyes > 1)
+	{
+		// both eyes of an instanced stereo pair are lit by a single draw issued from the primary view
+		if (EyeIndex != 0)
+		{
+			return;
+		}
+
+		EyeMask = 0x3;
+		ViewportRect.Union(View.GetInstancedView()->ViewRect);
+	}
+
 	FToonLightingParameters* PassParameter = GraphBuilder.AllocParameters< FToonLightingParameters>();
 	PassParameter->PS.View = View.ViewUniformBuffer;
 	PassParameter->PS.SceneTextures = SceneTextures.UniformBuffer;
+	PassParameter->PS.ToonAttributesTexture = ToonAttributesTexture;
 	PassParameter->PS.RenderTargets[0] = FRenderTargetBinding(SceneTextures.Color.Target, ERenderTargetLoadAction::ELoad);
+	PassParameter->PS.RenderTargets.DepthStencil = FDepthStencilBinding(SceneTextures.Depth.Target, ERenderTargetLoadAction::ELoad, ERenderTargetLoadAction::ELoad, FExclusiveDepthStencil::DepthRead_StencilRead);
 	PassParameter->VS.View = View.ViewUniformBuffer;
 
 	auto* DeferredLightStruct = GraphBuilder.AllocParameters<FDeferredLightUniformStruct>();
 	*DeferredLightStruct = GetDeferredLightParameters(View, *LightSceneInfo);
 	PassParameter->PS.DeferredLight = GraphBuilder.CreateUniformBuffer(DeferredLightStruct);
 
+	// shadows come from the projection already done for the standard deferred light
+	const bool bUseVirtualShadowMapMask = VirtualShadowMapId != INDEX_NONE && ShadowMaskBits;
+	PassParameter->PS.LightAttenuationTexture = ScreenShadowMaskTexture ? ScreenShadowMaskTexture : GSystemTextures.GetWhiteDummy(GraphBuilder);
+	PassParameter->PS.VirtualShadowMap = VirtualShadowMapUniformBuffer;
+	PassParameter->PS.VirtualShadowMapId = bUseVirtualShadowMapMask ? VirtualShadowMapId : INDEX_NONE;
+	PassParameter->PS.ShadowMaskBits = bUseVirtualShadowMapMask ? ShadowMaskBits : GSystemTextures.GetZeroUIntDummy(GraphBuilder);
+
+	if (bIsDirectional)
+	{
+		SetToonLightTileParameters(PassParameter, View, Tiles, EyeMask, ViewportRect);
+	}
+	else
+	{
+		// radial lights rasterize their bounding geometry instead of the toon tiles
+		PassParameter->RadialVS = FDeferredLightVS::GetParameters(View, LightSceneInfo);
+	}
+
 
-	RenderToonLight_Internal(GraphBuilder, SceneData, View, LightSceneInfo, PassParameter, ShaderName);
-}
\ No newline at end of file
+	RenderToonLight_Internal(GraphBuilder, SceneData, View, LightSceneInfo, ViewportRect, PassParameter, ShaderName);
+}
+
+bool FDeferredShadingSceneRenderer::HasVisibleToonMeshes(const FViewInfo& View) const
+{
+	// visibility only adds toon materials to the toon pass, so its draw count is the number of visible toon mesh elements.
+	// the secondary view of an instanced stereo pair is drawn by its primary view
+	const FViewInfo* DrawView = (View.bIsInstancedStereoEnabled && IStereoRendering::IsASecondaryView(View)) ? View.GetPrimaryView() : &View;
+	return DrawView->ParallelMeshDrawCommandPasses[EMeshPass::ToonPass].HasAnyDraw();
+}
+
+bool FDeferredShadingSceneRenderer::HasAnyVisibleToonMeshes() const
+{
+	for (const FViewInfo& View : Views)
+	{
+		if (HasVisibleToonMeshes(View))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool IsVisibleToonPrimitive(const FViewInfo& View, const FPrimitiveSceneInfo* PrimitiveSceneInfo, const TBitArray<SceneRenderingBitArrayAllocator>& DynamicToonPrimitives)
+{
+	const int32 PrimitiveIndex = PrimitiveSceneInfo->GetIndex();
+
+	if (!View.PrimitiveVisibilityMap[PrimitiveIndex])
+	{
+		return false;
+	}
+
+	if (DynamicToonPrimitives[PrimitiveIndex])
+	{
+		return true;
+	}
+
+	// cached static meshes already know it from their cached toon pass command, the material is only looked up for the rest
+	for (int32 MeshIndex = 0; MeshIndex < PrimitiveSceneInfo->StaticMeshes.Num(); MeshIndex++)
+	{
+		const FStaticMeshBatchRelevance& StaticMeshRelevance = PrimitiveSceneInfo->StaticMeshRelevances[MeshIndex];
+
+		if (StaticMeshRelevance.bSupportsCachingMeshDrawCommands
+			? StaticMeshRelevance.CommandInfosMask.Get(EMeshPass::ToonPass)
+			: IsToonMeshBatch(PrimitiveSceneInfo->StaticMeshes[MeshIndex], View.FeatureLevel))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool DoesLightReachVisibleToonPrimitive(const FScene* Scene, const FViewInfo& View, const FLightSceneInfo* LightSceneInfo, const TBitArray<SceneRenderingBitArrayAllocator>& DynamicToonPrimitives)
+{
+	// interactions are the primitives whose bounds touched the light's influence when they were added or moved
+	FLightPrimitiveInteraction* InteractionLists[] =
+	{
+		LightSceneInfo->GetDynamicInteractionOftenMovingPrimitiveList(false),
+		LightSceneInfo->GetDynamicInteractionStaticPrimitiveList(false)
+	};
+
+	for (FLightPrimitiveInteraction* InteractionList : InteractionLists)
+	{
+		for (FLightPrimitiveInteraction* Interaction = InteractionList; Interaction; Interaction = Interaction->GetNextPrimitive())
+		{
+			const FPrimitiveSceneInfo* PrimitiveSceneInfo = Interaction->GetPrimitiveSceneInfo();
+
+			if (IsVisibleToonPrimitive(View, PrimitiveSceneInfo, DynamicToonPrimitives)
+				&& LightSceneInfo->Proxy->AffectsBounds(Scene->PrimitiveBounds[PrimitiveSceneInfo->GetIndex()].BoxSphereBounds))
+			{
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+void FDeferredShadingSceneRenderer::GatherToonLights(
+	const FViewInfo& View,
+	const FSortedLightSetSceneInfo& SortedLightSet,
+	int32 FirstLightIndex,
+	TBitArray<SceneRenderingBitArrayAllocator>& OutToonLights) const
+{
+	const TArray<FSortedLightSceneInfo, SceneRenderingAllocator>& SortedLights = SortedLightSet.SortedLights;
+	OutToonLights.Init(false, SortedLights.Num());
+
+	const bool bCullLights = CVarToonLightCulling.GetValueOnRenderThread() != 0;
+
+	// the secondary view of an instanced stereo pair shares the visibility of its primary view
+	const FViewInfo& VisibilityView = (View.bIsInstancedStereoEnabled && IStereoRendering::IsASecondaryView(View)) ? *View.GetPrimaryView() : View;
+
+	// dynamic toon primitives are known from their toon pass relevance, static ones are checked through their static meshes
+	TBitArray<SceneRenderingBitArrayAllocator> DynamicToonPrimitives(false, bCullLights ? Scene->Primitives.Num() : 0);
+
+	if (bCullLights)
+	{
+		for (int32 ElementIndex = 0; ElementIndex < VisibilityView.DynamicMeshElements.Num(); ++ElementIndex)
+		{
+			if (VisibilityView.DynamicMeshElementsPassRelevance[ElementIndex].Get(EMeshPass::ToonPass))
+			{
+				const FPrimitiveSceneInfo* PrimitiveSceneInfo = VisibilityView.DynamicMeshElements[ElementIndex].PrimitiveSceneProxy->GetPrimitiveSceneInfo();
+				DynamicToonPrimitives[PrimitiveSceneInfo->GetIndex()] = true;
+			}
+		}
+	}
+
+	int32 NumCulledLights = 0;
+
+	for (int32 LightIndex = FirstLightIndex; LightIndex < SortedLights.Num(); LightIndex++)
+	{
+		const FLightSceneInfo* LightSceneInfo = SortedLights[LightIndex].LightSceneInfo;
+
+		// directional lights reach everything
+		if (!bCullLights
+			|| LightSceneInfo->Proxy->GetLightType() == LightType_Directional
+			|| DoesLightReachVisibleToonPrimitive(Scene, VisibilityView, LightSceneInfo, DynamicToonPrimitives))
+		{
+			OutToonLights[LightIndex] = true;
+		}
+		else
+		{
+			NumCulledLights++;
+		}
+	}
+
+	INC_DWORD_STAT_BY(STAT_ToonLightsCulled, NumCulledLights);
+}
+
+bool FDeferredShadingSceneRenderer::ShouldRenderClusteredToonLights() const
+{
+	return CVarToonClusteredLighting.GetValueOnRenderThread() != 0 && AreLightsInLightGrid();
+}
+
+void FDeferredShadingSceneRenderer::RenderClusteredToonLights(
+	FRDGBuilder& GraphBuilder,
+	const FMinimalSceneTextures& SceneTextures,
+	TRDGUniformBufferRef<FVirtualShadowMapUniformParameters> VirtualShadowMapUniformBuffer,
+	FRDGTextureRef ShadowMaskBits)
+{
+	if (!HasAnyVisibleToonMeshes())
+	{
+		return;
+	}
+
+	RDG_EVENT_SCOPE(GraphBuilder, "ClusteredToonLights");
+
+	// with one pass projection shadowed local lights stay in the light grid, their shadows are in the packed mask bits
+	const bool bUseVirtualShadowMapMask = ShadowMaskBits != nullptr;
+
+	// each eye of a stereo pair has its own light grid, so this pass runs for every view
+	for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ++ViewIndex)
+	{
+		const FViewInfo& View = Views[ViewIndex];
+
+		if (!HasVisibleToonMeshes(View))
+		{
+			continue;
+		}
+
+		RDG_GPU_MASK_SCOPE(GraphBuilder, View.GPUMask);
+		RDG_EVENT_SCOPE_CONDITIONAL(GraphBuilder, Views.Num() > 1, "View%d", ViewIndex);
+
+		uint32 EyeIndex = 0;
+		const FToonLightTiles* Tiles = GetToonLightTiles(View, EyeIndex);
+
+		// every light in the view's light grid is shaded by a single pass reading the GBuffer once
+		FToonLightingParameters* PassParameters = GraphBuilder.AllocParameters<FToonLightingParameters>();
+		PassParameters->PS.View = View.ViewUniformBuffer;
+		PassParameters->PS.SceneTextures = SceneTextures.UniformBuffer;
+		PassParameters->PS.ToonAttributesTexture = ToonAttributesTexture;
+		PassParameters->PS.ForwardLightData = View.ForwardLightingResources.ForwardLightUniformBuffer;
+		PassParameters->PS.VirtualShadowMap = VirtualShadowMapUniformBuffer;
+		PassParameters->PS.ShadowMaskBits = bUseVirtualShadowMapMask ? ShadowMaskBits : GSystemTextures.GetZeroUIntDummy(GraphBuilder);
+		PassParameters->PS.RenderTargets[0] = FRenderTargetBinding(SceneTextures.Color.Target, ERenderTargetLoadAction::ELoad);
+		PassParameters->PS.RenderTargets.DepthStencil = FDepthStencilBinding(SceneTextures.Depth.Target, ERenderTargetLoadAction::ELoad, ERenderTargetLoadAction::ELoad, FExclusiveDepthStencil::DepthRead_StencilRead);
+		PassParameters->VS.View = View.ViewUniformBuffer;
+		SetToonLightTileParameters(PassParameters, View, Tiles, 1u << EyeIndex, View.ViewRect);
+
+		FToonLightShaderPS::FPermutationDomain PermutationVector;
+		PermutationVector.Set<FToonLightShaderPS::FClusteredLightsDim>(true);
+		PermutationVector.Set<FToonLightShaderPS::FRadialLightDim>(false);
+		PermutationVector.Set<FToonLightShaderPS::FSimpleLightsDim>(false);
+		PermutationVector.Set<FToonLightShaderPS::FVirtualShadowMapMaskDim>(bUseVirtualShadowMapMask);
+		PermutationVector.Set<FToonLightShaderPS::FCompactAttributesDim>(ToonAttributesTexture != nullptr);
+		TShaderMapRef<FToonLightShaderPS> PixelShader(View.ShaderMap, PermutationVector);
+
+		GraphBuilder.AddPass(
+			RDG_EVENT_NAME("Light::ToonClustered"),
+			PassParameters,
+			ERDGPassFlags::Raster,
+			[&View, PixelShader, PassParameters](FRHICommandList& RHICmdList)
+		{
+			DrawToonLight(RHICmdList, View, View.ViewRect, PixelShader, PassParameters);
+		});
+	}
+}
+
+void FDeferredShadingSceneRenderer::RenderSimpleToonLights(
+	FRDGBuilder& GraphBuilder,
+	const FMinimalSceneTextures& SceneTextures,
+	const FSimpleLightArray& SimpleLights)
+{
+	if (!HasAnyVisibleToonMeshes())
+	{
+		return;
+	}
+
+	RDG_EVENT_SCOPE(GraphBuilder, "SimpleToonLights");
+
+	const int32 NumLights = SimpleLights.InstanceData.Num();
+
+	for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ++ViewIndex)
+	{
+		const FViewInfo& View = Views[ViewIndex];
+
+		if (!HasVisibleToonMeshes(View))
+		{
+			continue;
+		}
+
+		RDG_GPU_MASK_SCOPE(GraphBuilder, View.GPUMask);
+		RDG_EVENT_SCOPE_CONDITIONAL(GraphBuilder, Views.Num() > 1, "View%d", ViewIndex);
+
+		// three entries per light, see ToonSimpleLights in ToonLightingShader.usf
+		TArray<FVector4f, SceneRenderingAllocator> LightData;
+		LightData.Reserve(NumLights * 3);
+
+		for (int32 LightIndex = 0; LightIndex < NumLights; LightIndex++)
+		{
+			const FSimpleLightEntry& SimpleLight = SimpleLights.InstanceData[LightIndex];
+			const FSimpleLightPerViewEntry& SimpleLightPerViewData = SimpleLights.GetViewDependentData(LightIndex, ViewIndex, Views.Num());
+			const FSphere LightBounds(SimpleLightPerViewData.Position, SimpleLight.Radius);
+
+			FVector4f SpherePositionAndScale;
+			StencilingGeometry::GStencilSphereVertexBuffer.CalcTransform(SpherePositionAndScale, LightBounds, View.ViewMatrices.GetPreViewTranslation());
+
+			LightData.Add(SpherePositionAndScale);
+			LightData.Add(FVector4f(1.0f / FMath::Max(SimpleLight.Radius, KINDA_SMALL_NUMBER), SimpleLight.Exponent, 0.0f, 0.0f));
+			LightData.Add(FVector4f(SimpleLight.Color, 0.0f));
+		}
+
+		FRDGBufferRef LightDataBuffer = CreateVertexBuffer(
+			GraphBuilder,
+			TEXT("Toon.SimpleLights"),
+			FRDGBufferDesc::CreateBufferDesc(sizeof(FVector4f), LightData.Num()),
+			LightData.GetData(),
+			LightData.Num() * LightData.GetTypeSize());
+		FRDGBufferSRVRef LightDataSRV = GraphBuilder.CreateSRV(LightDataBuffer, PF_A32B32G32R32F);
+
+		FToonLightingParameters* PassParameters = GraphBuilder.AllocParameters<FToonLightingParameters>();
+		PassParameters->PS.View = View.ViewUniformBuffer;
+		PassParameters->PS.SceneTextures = SceneTextures.UniformBuffer;
+		PassParameters->PS.ToonAttributesTexture = ToonAttributesTexture;
+		PassParameters->PS.ToonSimpleLights = LightDataSRV;
+		PassParameters->PS.RenderTargets[0] = FRenderTargetBinding(SceneTextures.Color.Target, ERenderTargetLoadAction::ELoad);
+		PassParameters->PS.RenderTargets.DepthStencil = FDepthStencilBinding(SceneTextures.Depth.Target, ERenderTargetLoadAction::ELoad, ERenderTargetLoadAction::ELoad, FExclusiveDepthStencil::DepthRead_StencilRead);
+		PassParameters->SimpleLightVS.View = View.ViewUniformBuffer;
+		PassParameters->SimpleLightVS.ToonSimpleLights = LightDataSRV;
+
+		FToonLightShaderPS::FPermutationDomain PermutationVector;
+		PermutationVector.Set<FToonLightShaderPS::FClusteredLightsDim>(false);
+		PermutationVector.Set<FToonLightShaderPS::FRadialLightDim>(false);
+		PermutationVector.Set<FToonLightShaderPS::FSimpleLightsDim>(true);
+		PermutationVector.Set<FToonLightShaderPS::FVirtualShadowMapMaskDim>(false);
+		PermutationVector.Set<FToonLightShaderPS::FCompactAttributesDim>(ToonAttributesTexture != nullptr);
+		TShaderMapRef<FToonLightShaderPS> PixelShader(View.ShaderMap, PermutationVector);
+		TShaderMapRef<FToonSimpleLightVS> VertexShader(View.ShaderMap);
+
+		GraphBuilder.AddPass(
+			RDG_EVENT_NAME("Light::ToonSimpleLights %d", NumLights),
+			PassParameters,
+			ERDGPassFlags::Raster,
+			[&View, PixelShader, VertexShader, PassParameters, NumLights](FRHICommandList& RHICmdList)
+		{
+			FGraphicsPipelineStateInitializer GraphicsPSOInit;
+			RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
+			// Set the device viewport for the view.
+			RHICmdList.SetViewport(View.ViewRect.Min.X, View.ViewRect.Min.Y, 0.0f, View.ViewRect.Max.X, View.ViewRect.Max.Y, 1.0f);
+
+			GraphicsPSOInit.BlendState = TStaticBlendState<CW_RGBA, BO_Add, BF_One, BF_One, BO_Add, BF_One, BF_One>::GetRHI();
+			GraphicsPSOInit.PrimitiveType = PT_TriangleList;
+			GraphicsPSOInit.bDepthBounds = false;
+
+			// the camera can be inside any of the spheres, so back faces behind the scene depth are drawn for all of them
+			GraphicsPSOInit.RasterizerState = View.bReverseCulling ? TStaticRasterizerState<FM_Solid, CM_CW>::GetRHI() : TStaticRasterizerState<FM_Solid, CM_CCW>::GetRHI();
+			GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<
+				false, CF_DepthFartherOrEqual,
+				true, CF_Equal, SO_Keep, SO_Keep, SO_Keep,
+				false, CF_Always, SO_Keep, SO_Keep, SO_Keep,
+				STENCIL_TOON_MASK, 0x00>::GetRHI();
+
+			GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = GetVertexDeclarationFVector4();
+			GraphicsPSOInit.BoundShaderState.VertexShaderRHI = VertexShader.GetVertexShader();
+			GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PixelShader.GetPixelShader();
+			SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit, STENCIL_TOON_MASK);
+
+			SetShaderParameters(RHICmdList, PixelShader, PixelShader.GetPixelShader(), PassParameters->PS);
+			SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), PassParameters->SimpleLightVS);
+
+			// all simple lights in one instanced draw of the stencil sphere
+			RHICmdList.SetStreamSource(0, StencilingGeometry::GStencilSphereVertexBuffer.VertexBufferRHI, 0);
+			RHICmdList.DrawIndexedPrimitive(
+				StencilingGeometry::GStencilSphereIndexBuffer.IndexBufferRHI,
+				0,
+				0,
+				StencilingGeometry::GStencilSphereVertexBuffer.GetVertexCount(),
+				0,
+				StencilingGeometry::GStencilSphereIndexBuffer.GetIndexCount() / 3,
+				NumLights);
+		});
+	}
+}
+
+void FDeferredShadingSceneRenderer::RenderToonTileClassification(
+	FRDGBuilder& GraphBuilder,
+	const FSceneTextures& SceneTextures)
+{
+	ToonLightTiles.Reset();
+	ToonLightTiles.SetNum(Views.Num());
+
+	// the toon mask is in the compact toon attributes when the toon pass wrote them, in GBufferD otherwise
+	const bool bUseCompactAttributes = ToonAttributesTexture != nullptr;
+	const bool bHasToonMask = bUseCompactAttributes || SceneTextures.GBufferD != nullptr;
+
+	if (CVarToonTileClassification.GetValueOnRenderThread() == 0 || !bHasToonMask || !HasAnyVisibleToonMeshes())
+	{
+		return;
+	}
+
+	RDG_EVENT_SCOPE(GraphBuilder, "ToonTileClassification");
+
+	for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ++ViewIndex)
+	{
+		const FViewInfo& View = Views[ViewIndex];
+		RDG_GPU_MASK_SCOPE(GraphBuilder, View.GPUMask);
+		RDG_EVENT_SCOPE_CONDITIONAL(GraphBuilder, Views.Num() > 1, "View%d", ViewIndex);
+
+		// secondary views of an instanced stereo pair are classified along with their primary view
+		if (!View.ShouldRenderView() || !HasVisibleToonMeshes(View))
+		{
+			continue;
+		}
+
+		const FViewInfo* InstancedView = View.IsInstancedStereoPass() ? View.GetInstancedView() : nullptr;
+		const int32 NumEyes = InstancedView ? 2 : 1;
+
+		FIntPoint TileCount = FIntPoint::DivideAndRoundUp(View.ViewRect.Size(), ToonTileSize);
+		if (InstancedView)
+		{
+			TileCount = TileCount.ComponentMax(FIntPoint::DivideAndRoundUp(InstancedView->ViewRect.Size(), ToonTileSize));
+		}
+
+		FRDGBufferRef TileListBuffer = GraphBuilder.CreateBuffer(FRDGBufferDesc::CreateBufferDesc(sizeof(uint32), TileCount.X * TileCount.Y * NumEyes), TEXT("Toon.TileList"));
+		FRDGBufferRef TileIndirectArgs = GraphBuilder.CreateBuffer(FRDGBufferDesc::CreateIndirectDesc<FRHIDrawIndirectParameters>(1), TEXT("Toon.TileIndirectArgs"));
+
+		// the instance count is accumulated by the classification pass
+		FRDGBufferUAVRef TileIndirectArgsUAV = GraphBuilder.CreateUAV(TileIndirectArgs, PF_R32_UINT);
+		AddClearUAVPass(GraphBuilder, TileIndirectArgsUAV, 0);
+
+		FToonTileClassificationCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FToonTileClassificationCS::FParameters>();
+		PassParameters->View = View.GetShaderParameters();
+		PassParameters->ToonMaskTexture = SceneTextures.GBufferD;
+		PassParameters->ToonAttributesTexture = ToonAttributesTexture;
+		PassParameters->RWToonTileList = GraphBuilder.CreateUAV(TileListBuffer, PF_R32_UINT);
+		PassParameters->RWTileIndirectArgs = TileIndirectArgsUAV;
+
+		FToonTileClassificationCS::FPermutationDomain PermutationVector;
+		PermutationVector.Set<FToonTileClassificationCS::FCompactAttributesDim>(bUseCompactAttributes);
+		TShaderMapRef<FToonTileClassificationCS> ComputeShader(View.ShaderMap, PermutationVector);
+
+		FComputeShaderUtils::AddPass(
+			GraphBuilder,
+			RDG_EVENT_NAME("ClassifyToonTiles %dx%dx%d", TileCount.X, TileCount.Y, NumEyes),
+			ComputeShader,
+			PassParameters,
+			FIntVector(TileCount.X, TileCount.Y, NumEyes));
+
+		ToonLightTiles[ViewIndex].TileList = GraphBuilder.CreateSRV(TileListBuffer, PF_R32_UINT);
+		ToonLightTiles[ViewIndex].TileIndirectArgs = TileIndirectArgs;
+		ToonLightTiles[ViewIndex].NumEyes = NumEyes;
+	}
+}
+
+const FToonLightTiles* FDeferredShadingSceneRenderer::GetToonLightTiles(const FViewInfo& View, uint32& OutEyeIndex) const
+{
+	// the secondary view of an instanced stereo pair uses the second eye of its primary view's tiles
+	const FViewInfo* TilesView = &View;
+	OutEyeIndex = 0;
+
+	if (View.bIsInstancedStereoEnabled && IStereoRendering::IsASecondaryView(View))
+	{
+		TilesView = View.GetPrimaryView();
+		OutEyeIndex = 1;
+	}
+
+	for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ++ViewIndex)
+	{
+		if (&Views[ViewIndex] == TilesView && ToonLightTiles.IsValidIndex(ViewIndex) && ToonLightTiles[ViewIndex].TileIndirectArgs)
+		{
+			return &ToonLightTiles[ViewIndex];
+		}
+	}
+
+	return nullptr;
+}
+
+
+BEGIN_SHADER_PARAMETER_STRUCT(FToonStencilParameters, )
+	SHADER_PARAMETER_STRUCT_INCLUDE(FToonLightShaderVS::FParameters, VS)
+	SHADER_PARAMETER_STRUCT_INCLUDE(FToonStencilTagPS::FParameters, PS)
+	RENDER_TARGET_BINDING_SLOTS()
+END_SHADER_PARAMETER_STRUCT()
+
+/** the toon bit is set to StencilRef on the pixels the pixel shader keeps, the other stencil bits are kept */
+static void SetToonStencilPipelineState(
+	FRHICommandList& RHICmdList,
+	const TShaderMapRef<FToonLightShaderVS>& VertexShader,
+	FRHIPixelShader* PixelShader,
+	uint32 StencilRef)
+{
+	FGraphicsPipelineStateInitializer GraphicsPSOInit;
+	RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
+
+	GraphicsPSOInit.BlendState = TStaticBlendState<>::GetRHI();
+	GraphicsPSOInit.RasterizerState = TStaticRasterizerState<FM_Solid, CM_None>::GetRHI();
+	GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<
+		false, CF_Always,
+		true, CF_Always, SO_Keep, SO_Keep, SO_Replace,
+		false, CF_Always, SO_Keep, SO_Keep, SO_Keep,
+		0x00, STENCIL_TOON_MASK>::GetRHI();
+	GraphicsPSOInit.PrimitiveType = PT_TriangleList;
+	GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = GFilterVertexDeclaration.VertexDeclarationRHI;
+	GraphicsPSOInit.BoundShaderState.VertexShaderRHI = VertexShader.GetVertexShader();
+	GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PixelShader;
+	SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit, StencilRef);
+}
+
+static void DrawToonStencilRect(FRHICommandList& RHICmdList, const FViewInfo& View, const TShaderMapRef<FToonLightShaderVS>& VertexShader)
+{
+	DrawRectangle(
+		RHICmdList,
+		0, 0,
+		View.ViewRect.Width(), View.ViewRect.Height(),
+		View.ViewRect.Min.X, View.ViewRect.Min.Y,
+		View.ViewRect.Width(), View.ViewRect.Height(),
+		View.ViewRect.Size(),
+		View.GetSceneTexturesConfig().Extent,
+		VertexShader,
+		EDRF_Default);
+}
+
+void FDeferredShadingSceneRenderer::TagToonStencil(
+	FRDGBuilder& GraphBuilder,
+	const FSceneTextures& SceneTextures)
+{
+	// the toon mask is in the compact toon attributes when the toon pass wrote them, in GBufferD otherwise
+	const bool bUseCompactAttributes = ToonAttributesTexture != nullptr;
+	const bool bHasToonMask = bUseCompactAttributes || SceneTextures.GBufferD != nullptr;
+
+	if (!bHasToonMask || !HasAnyVisibleToonMeshes())
+	{
+		return;
+	}
+
+	RDG_EVENT_SCOPE(GraphBuilder, "TagToonStencil");
+
+	for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ++ViewIndex)
+	{
+		const FViewInfo& View = Views[ViewIndex];
+		RDG_GPU_MASK_SCOPE(GraphBuilder, View.GPUMask);
+
+		// every view tags its own rect, including the secondary view of an instanced stereo pair
+		if (!HasVisibleToonMeshes(View))
+		{
+			continue;
+		}
+
+		FToonStencilParameters* PassParameters = GraphBuilder.AllocParameters<FToonStencilParameters>();
+		PassParameters->VS.View = View.ViewUniformBuffer;
+		PassParameters->PS.ToonMaskTexture = SceneTextures.GBufferD;
+		PassParameters->PS.ToonAttributesTexture = ToonAttributesTexture;
+		PassParameters->RenderTargets.DepthStencil = FDepthStencilBinding(SceneTextures.Depth.Target, ERenderTargetLoadAction::ELoad, ERenderTargetLoadAction::ELoad, FExclusiveDepthStencil::DepthRead_StencilWrite);
+
+		FToonStencilTagPS::FPermutationDomain PermutationVector;
+		PermutationVector.Set<FToonStencilTagPS::FCompactAttributesDim>(bUseCompactAttributes);
+		TShaderMapRef<FToonStencilTagPS> PixelShader(View.ShaderMap, PermutationVector);
+
+		GraphBuilder.AddPass(
+			RDG_EVENT_NAME("TagToonStencil"),
+			PassParameters,
+			ERDGPassFlags::Raster,
+			[&View, PixelShader, PassParameters](FRHICommandList& RHICmdList)
+		{
+			TShaderMapRef<FToonLightShaderVS> VertexShader(View.ShaderMap);
+
+			RHICmdList.SetViewport(View.ViewRect.Min.X, View.ViewRect.Min.Y, 0.0f, View.ViewRect.Max.X, View.ViewRect.Max.Y, 1.0f);
+
+			// reset the bit first, the ray tracing LOD fading mask may have set it on non-toon pixels
+			SetToonStencilPipelineState(RHICmdList, VertexShader, nullptr, 0);
+			SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), PassParameters->VS);
+			DrawToonStencilRect(RHICmdList, View, VertexShader);
+
+			SetToonStencilPipelineState(RHICmdList, VertexShader, PixelShader.GetPixelShader(), STENCIL_TOON_MASK);
+			SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), PassParameters->VS);
+			SetShaderParameters(RHICmdList, PixelShader, PixelShader.GetPixelShader(), PassParameters->PS);
+			DrawToonStencilRect(RHICmdList, View, VertexShader);
+		});
+	}
+}
+
+void FDeferredShadingSceneRenderer::ClearToonStencil(
+	FRDGBuilder& GraphBuilder,
+	const FMinimalSceneTextures& SceneTextures)
+{
+	if (!HasAnyVisibleToonMeshes())
+	{
+		return;
+	}
+
+	RDG_EVENT_SCOPE(GraphBuilder, "ClearToonStencil");
+
+	for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ++ViewIndex)
+	{
+		const FViewInfo& View = Views[ViewIndex];
+		RDG_GPU_MASK_SCOPE(GraphBuilder, View.GPUMask);
+
+		// every view clears its own rect, including the secondary view of an instanced stereo pair
+		if (!HasVisibleToonMeshes(View))
+		{
+			continue;
+		}
+
+		FToonStencilParameters* PassParameters = GraphBuilder.AllocParameters<FToonStencilParameters>();
+		PassParameters->VS.View = View.ViewUniformBuffer;
+		PassParameters->RenderTargets.DepthStencil = FDepthStencilBinding(SceneTextures.Depth.Target, ERenderTargetLoadAction::ELoad, ERenderTargetLoadAction::ELoad, FExclusiveDepthStencil::DepthRead_StencilWrite);
+
+		GraphBuilder.AddPass(
+			RDG_EVENT_NAME("ClearToonStencil"),
+			PassParameters,
+			ERDGPassFlags::Raster,
+			[&View, PassParameters](FRHICommandList& RHICmdList)
+		{
+			TShaderMapRef<FToonLightShaderVS> VertexShader(View.ShaderMap);
+
+			RHICmdList.SetViewport(View.ViewRect.Min.X, View.ViewRect.Min.Y, 0.0f, View.ViewRect.Max.X, View.ViewRect.Max.Y, 1.0f);
+
+			SetToonStencilPipelineState(RHICmdList, VertexShader, nullptr, 0);
+			SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), PassParameters->VS);
+			DrawToonStencilRect(RHICmdList, View, VertexShader);
+		});
+	}
+}
@@ -29,6 +29,64 @@
 #include "BlueNoise.h"
 #include "StaticMeshBatch.h"
 
+/** stencil bit tagged by TagToonStencil so toon lighting only runs on toon pixels and the standard lights skip them.
+ *  the engine has no spare stencil bit, so the sandbox bit is borrowed for the duration of RenderLights. the deferred stencil clear
+ *  after the decals and the ray tracing LOD fading mask both write it after the base pass, so the tag is written right
+ *  before the lights, replacing the LOD fading mask, and ClearToonStencil resets it to 0 after the lights. */
+#define STENCIL_TOON_BIT_ID STENCIL_SANDBOX_BIT_ID
+#define STENCIL_TOON_MASK GET_STENCIL_BIT_MASK(TOON, 1)
+
+/** r.AllowDepthBoundsTest, defined in LightRendering.cpp. toon lights cull with the depth bounds of the standard deferred lights */
+extern int32 GAllowDepthBoundsTest;
+
+/** depth bounds of a light's bounding sphere, defined in LightRendering.cpp */
+extern void CalculateLightNearFarDepthFromBounds(const FViewInfo& View, const FSphere& LightBounds, float& NearDepth, float& FarDepth);
+
+/** whether the mesh batch is drawn by the toon passes, same material test as the toon pass processors */
+inline bool IsToonMeshBatch(const FMeshBatch& MeshBatch, ERHIFeatureLevel::Type FeatureLevel)
+{
+	const FMaterial* Material = MeshBatch.MaterialRenderProxy ? MeshBatch.MaterialRenderProxy->GetMaterialNoFallback(FeatureLevel) : nullptr;
+	return Material && Material->UseToonRendering();
+}
+
+/** toon mesh shaders are only drawn through FMeshBatch. nanite meshes are shaded by the nanite base pass and never reach the toon passes,
+ *  so the nanite vertex factory permutations would only cost compile time and memory */
+inline bool ShouldCompileToonMeshShader(const FMeshMaterialShaderPermutationParameters& Parameters)
+{
+	return Parameters.MaterialParameters.bUseToonRendering && !Parameters.VertexFactoryType->SupportsNaniteRendering();
+}
+
+/** whether the toon pass writes the compact toon attributes target read by toon lighting, r.Toon.CompactAttributes */
+extern bool IsToonCompactAttributesEnabled();
+
+/** packed normal, color and shininess of toon pixels, zero on pixels the toon pass did not draw */
+static constexpr EPixelFormat ToonAttributesFormat = PF_R32G32_UINT;
+
+/** render target slot of the compact toon attributes, after the seven GBuffer targets the toon shaders write */
+static constexpr uint32 ToonAttributesTargetIndex = 7;
+
+/** whether the toon pass writes the compact toon attributes over this many base pass targets.
+ *  the toon pass blend state, the attributes binding and toon lighting all use it, other GBuffer layouts keep the GBufferD path */
+extern bool ShouldWriteToonCompactAttributes(uint32 GBufferTargetCount);
+
+/** same decision for the GBuffer layout of the feature level's default scene textures config.
+ *  it does not change between frames, so cached toon mesh draw commands and the per frame binding agree on it */
+extern bool ShouldWriteToonCompactAttributes(ERHIFeatureLevel::Type FeatureLevel);
+
+class FViewCommands;
+
+/** sort key of a toon mesh draw, ordered by shaders until a depth bucket is set */
+extern FMeshDrawCommandSortKey GetToonMeshSortKey(const FMeshMaterialShader* VertexShader, const FMeshMaterialShader* PixelShader);
+
+/** whether the visible draws of a toon pass are ordered coarsely front to back, r.Toon.FrontToBackSort and r.Toon.Outline.FrontToBackSort */
+extern bool ShouldSortToonMeshesFrontToBack(EMeshPass::Type MeshPass);
+
+/** coarse front to back bucket of a primitive, close buckets are merged so draws with the same shaders stay grouped */
+extern uint16 GetToonMeshDepthBucket(const FVector& ViewOrigin, const FBoxSphereBounds& Bounds);
+
+/** sets the depth bucket of the visible cached toon draws of the view, dynamic toon draws get it when they are built */
+extern void UpdateToonMeshSortKeys(const FViewInfo& View, const FScene& Scene, FViewCommands& ViewCommands);
+
 /** toon outline pass */
 
 class FToonOutlineShaderVS : public FMeshMaterialShader
@@ -42,7 +100,7 @@ public:
 	FToonOutlineShaderVS(const FMeshMaterialShaderType::CompiledShaderInitializerType& Initializer)
 		: FMeshMaterialShader(Initializer)
 	{
-		ToonOutlineThickness.Bind(Initializer.ParameterMap, TEXT("ToonOutlineThickness"));
+
 	}
 
 	static void ModifyCompilationEnvironment(const FShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
@@ -52,7 +110,7 @@ public:
 
 	static bool ShouldCompilePermutation(const FMeshMaterialShaderPermutationParameters& Parameters)
 	{
-		return Parameters.MaterialParameters.bUseToonRendering;
+		return ShouldCompileToonMeshShader(Parameters);
 	}
 
 	void GetShaderBindings(
@@ -67,13 +125,9 @@ public:
 	{
 		FMeshMaterialShader::GetShaderBindings(Scene, FeatureLevel, PrimitiveSceneProxy, MaterialRenderProxy, Material, DrawRenderState, ShaderElementData, ShaderBindings);
 
-		float OutlineThickness = Material.GetToonOutlineThickness();
-
-		ShaderBindings.Add(ToonOutlineThickness, OutlineThickness);
+		// toon values live in a uniform buffer per material, so they add no loose data to the draw command
+		ShaderBindings.Add(GetUniformBufferParameter<FToonMaterialParameters>(), Material.GetToonUniformBuffer());
 	}
-
-	LAYOUT_FIELD(FShaderParameter, ToonOutlineThickness);
-
 };
 
 class FToonOutlineShaderPS : public FMeshMaterialShader
@@ -87,7 +141,7 @@ public:
 	FToonOutlineShaderPS(const FMeshMaterialShaderType::CompiledShaderInitializerType& Initializer)
 		: FMeshMaterialShader(Initializer)
 	{
-		ToonOutlineColor.Bind(Initializer.ParameterMap, TEXT("ToonOutlineColor"));
+
 	}
 
 	static void ModifyCompilationEnvironment(const FShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
@@ -98,7 +152,7 @@ public:
 
 	static bool ShouldCompilePermutation(const FMeshMaterialShaderPermutationParameters& Parameters)
 	{
-		return Parameters.MaterialParameters.bUseToonRendering;
+		return ShouldCompileToonMeshShader(Parameters);
 	}
 
 
@@ -113,14 +167,7 @@ public:
 		FMeshDrawSingleShaderBindings& ShaderBindings) const
 	{
 		FMeshMaterialShader::GetShaderBindings(Scene, FeatureLevel, PrimitiveSceneProxy, MaterialRenderProxy, Material, DrawRenderState, ShaderElementData, ShaderBindings);
-
-
-		FLinearColor OutlineColor = Material.GetToonOutlineColor();
-
-		ShaderBindings.Add(ToonOutlineColor, OutlineColor);
 	}
-
-	LAYOUT_FIELD(FShaderParameter, ToonOutlineColor);
 };
 
 
@@ -150,6 +197,8 @@ public:
 
 	virtual void AddMeshBatch(const FMeshBatch& RESTRICT MeshBatch, uint64 BatchElementMask, const FPrimitiveSceneProxy* RESTRICT PrimitiveSceneProxy, int32 StaticMeshId = -1) override final;
 
+	virtual void CollectPSOInitializers(const FSceneTexturesConfig& SceneTexturesConfig, const FMaterial& Material, const FPSOPrecacheVertexFactoryData& VertexFactoryData, const FPSOPrecacheParams& PreCacheParams, TArray<FPSOPrecacheData>& PSOInitializers) override final;
+
 private:
 
 	bool Process(
@@ -166,6 +215,12 @@ private:
 
 /** toon shader pass */
 
+/** DBuffer decals for the toon pass, bound as ToonPass */
+BEGIN_UNIFORM_BUFFER_STRUCT(FToonPassUniformParameters, )
+	SHADER_PARAMETER_RDG_TEXTURE(Texture2D, DBufferATexture)
+	SHADER_PARAMETER_RDG_TEXTURE(Texture2D, DBufferBTexture)
+END_UNIFORM_BUFFER_STRUCT()
+
 class FToonShaderVS : public FMeshMaterialShader
 {
 	DECLARE_SHADER_TYPE(FToonShaderVS, MeshMaterial);
@@ -184,12 +239,13 @@ public:
 	static void ModifyCompilationEnvironment(const FShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
 	{
 		FMeshMaterialShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("TOON_WRITES_VELOCITY"), FVelocityRendering::BasePassCanOutputVelocity(Parameters.Platform) ? 1 : 0);
 	}
 
 
 	static bool ShouldCompilePermutation(const FMeshMaterialShaderPermutationParameters& Parameters)
 	{
-		return Parameters.MaterialParameters.bUseToonRendering;
+		return ShouldCompileToonMeshShader(Parameters);
 	}
 
 
@@ -205,6 +261,8 @@ public:
 	{
 		FMeshMaterialShader::GetShaderBindings(Scene, FeatureLevel, PrimitiveSceneProxy, MaterialRenderProxy, Material, DrawRenderState, ShaderElementData, ShaderBindings);
 
+		// toon values are resolved per instance in the vertex shader
+		ShaderBindings.Add(GetUniformBufferParameter<FToonMaterialParameters>(), Material.GetToonUniformBuffer());
 	}
 };
 
@@ -215,13 +273,16 @@ class FToonShaderPS : public FMeshMaterialShader
 
 public:
 
+	// the compact toon attributes are written to SV_Target7, selected by the toon pass processor
+	class FCompactAttributesDim : SHADER_PERMUTATION_BOOL("TOON_COMPACT_ATTRIBUTES");
+	using FPermutationDomain = TShaderPermutationDomain<FCompactAttributesDim>;
+
 	FToonShaderPS() {}
 
 	FToonShaderPS(const FMeshMaterialShaderType::CompiledShaderInitializerType& Initializer)
 		: FMeshMaterialShader(Initializer)
 	{
-		ToonColor.Bind(Initializer.ParameterMap, TEXT("ToonColor"));
-		ToonShininess.Bind(Initializer.ParameterMap, TEXT("ToonShininess"));
+
 	}
 
 	static void ModifyCompilationEnvironment(
@@ -229,12 +290,16 @@ public:
 		FShaderCompilerEnvironment& OutEnvironment)
 	{
 		FMeshMaterialShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+
+		// toon meshes are not drawn by the base pass, so the toon pass writes their velocity and applies the DBuffer decals
+		OutEnvironment.SetDefine(TEXT("TOON_WRITES_VELOCITY"), FVelocityRendering::BasePassCanOutputVelocity(Parameters.Platform) ? 1 : 0);
+		OutEnvironment.SetDefine(TEXT("TOON_DBUFFER"), IsUsingDBuffers(Parameters.Platform) ? 1 : 0);
 	}
 
 
 	static bool ShouldCompilePermutation(const FMeshMaterialShaderPermutationParameters& Parameters)
 	{
-		return Parameters.MaterialParameters.bUseToonRendering;
+		return ShouldCompileToonMeshShader(Parameters);
 	}
 
 
@@ -250,18 +315,7 @@ public:
 	{
 		FMeshMaterialShader::GetShaderBindings(Scene, FeatureLevel, PrimitiveSceneProxy,
 			MaterialRenderProxy, Material, DrawRenderState, ShaderElementData, ShaderBindings);
-
-		FLinearColor Color = Material.GetToonColor();
-
-		float Shininess = Material.GetToonShininess();
-
-		ShaderBindings.Add(ToonColor, Color);
-
-		ShaderBindings.Add(ToonShininess, Shininess);
 	}
-
-	LAYOUT_FIELD(FShaderParameter, ToonColor);
-	LAYOUT_FIELD(FShaderParameter, ToonShininess);
 };
 
 
@@ -273,7 +327,8 @@ public:
 		FToonPassProcessor(EMeshPass::Num, InScene, InFeatureLevel, InViewIfDynamicMeshCommand, InDrawListContext) { }
 
 	FToonPassProcessor(EMeshPass::Type InMeshPassType, const FScene* InScene, ERHIFeatureLevel::Type InFeatureLevel, const FSceneView* InViewIfDynamicMeshCommand, FMeshPassDrawListContext* InDrawListContext) :
-		FMeshPassProcessor(InMeshPassType, InScene, InFeatureLevel, InViewIfDynamicMeshCommand, InDrawListContext) {}
+		FMeshPassProcessor(InMeshPassType, InScene, InFeatureLevel, InViewIfDynamicMeshCommand, InDrawListContext),
+		bWriteCompactAttributes(ShouldWriteToonCompactAttributes(InFeatureLevel)) {}
 
 	FToonPassProcessor(
 		EMeshPass::Type InMeshPassType,
@@ -287,7 +342,8 @@ public:
 		const bool bDitheredLODFadingOutMaskPass,
 		FMeshPassDrawListContext* InDrawListContext,
 		const bool bShadowProjection = false)
-		: FMeshPassProcessor(InMeshPassType, Scene, FeatureLevel, InViewIfDynamicMeshCommand, InDrawListContext) {}
+		: FMeshPassProcessor(InMeshPassType, Scene, FeatureLevel, InViewIfDynamicMeshCommand, InDrawListContext),
+		bWriteCompactAttributes(ShouldWriteToonCompactAttributes(FeatureLevel)) {}
 
 
 	virtual void AddMeshBatch(
@@ -296,6 +352,13 @@ public:
 		const FPrimitiveSceneProxy* RESTRICT PrimitiveSceneProxy,
 		int32 StaticMeshId = -1) override final;
 
+	virtual void CollectPSOInitializers(
+		const FSceneTexturesConfig& SceneTexturesConfig,
+		const FMaterial& Material,
+		const FPSOPrecacheVertexFactoryData& VertexFactoryData,
+		const FPSOPrecacheParams& PreCacheParams,
+		TArray<FPSOPrecacheData>& PSOInitializers) override final;
+
 private:
 
 	bool Process(
@@ -308,5 +371,7 @@ private:
 		ERasterizerFillMode MeshFillMode,
 		ERasterizerCullMode MeshCullMode);
 
+	/** whether the toon pass blend state masks GBufferD for the compact toon attributes target */
+	const bool bWriteCompactAttributes;
 };
 
@@ -3435,13 +3435,13 @@ void FDeferredShadingSceneRenderer::Render(FRDGBuilder& GraphBuilder)
 		RenderBasePass(GraphBuilder, SceneTextures, DBufferTextures, BasePassDepthStencilAccess, ForwardScreenSpaceShadowMaskTexture, InstanceCullingManager, bNaniteEnabled, NaniteRasterResults);
 		GraphBuilder.AddDispatchHint();
 		
-		// render toon outline begin
-		RenderToonOutlinePass(GraphBuilder, InstanceCullingManager, SortedLightSet, SceneTextures, BasePassDepthStencilAccess);
-		// render toon outline end
-		
-		// render toon pass begin
-		RenderToonPass(GraphBuilder, InstanceCullingManager, SortedLightSet, SceneTextures,BasePassDepthStencilAccess);
-		//render toon pass end
+		// render toon outline and toon pass begin
+		RenderToonMeshPasses(GraphBuilder, InstanceCullingManager, SortedLightSet, SceneTextures, DBufferTextures);
+		// render toon outline and toon pass end
+
+		// toon tile classification begin
+		RenderToonTileClassification(GraphBuilder, SceneTextures);
+		// toon tile classification end
 
 
 
@@ -3767,6 +3767,10 @@ void FDeferredShadingSceneRenderer::Render(FRDGBuilder& GraphBuilder)
 		}
 #endif
 
+		// custom toon lights begin
+		TagToonStencil(GraphBuilder, SceneTextures);
+		// custom toon lights end
+
 		GraphBuilder.SetCommandListStat(GET_STATID(STAT_CLM_Lighting));
 		RenderLights(GraphBuilder, SceneTextures, TranslucencyLightingVolumeTextures, LightingChannelsTexture, SortedLightSet);
 		GraphBuilder.SetCommandListStat(GET_STATID(STAT_CLM_AfterLighting));
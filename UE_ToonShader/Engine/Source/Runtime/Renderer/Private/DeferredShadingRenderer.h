@@ -42,6 +42,7 @@ namespace LumenRadianceCache
 }
 class FRenderLightParameters;
 class FRayTracingScene;
+class FVirtualShadowMapUniformParameters;
 
 struct FSceneWithoutWaterTextures;
 struct FRayTracingReflectionOptions;
@@ -229,6 +230,19 @@ private:
 };
 
 
+/** Compacted list of screen tiles that contain toon pixels, built per view after the toon pass */
+struct FToonLightTiles
+{
+	/** Packed tile coordinates, x in the low 16 bits and y in the high 16 bits */
+	FRDGBufferSRVRef TileList = nullptr;
+
+	/** Draw indirect arguments with one instance per tile */
+	FRDGBufferRef TileIndirectArgs = nullptr;
+
+	/** 2 when the list also holds the tiles of the instanced stereo view, flagged in the top bit */
+	int32 NumEyes = 1;
+};
+
 /**
  * Encapsulates the resources and render targets used by global illumination plugins.
  */
@@ -324,30 +338,79 @@ public:
 	/** Clears a view */
 	void ClearView(FRHICommandListImmediate& RHICmdList);
 
-	/** Render Toon Outline Pass */
-	void RenderToonOutlinePass(FRDGBuilder& GraphBuilder,
-		FInstanceCullingManager& InstanceCullingManager,
-		FSortedLightSetSceneInfo& SortedLightSet,
-		FSceneTextures& SceneTextures,
-		FExclusiveDepthStencil::Type BasePassDepthStencilAccess);
+	/** Whether the visibility stage found a toon mesh element in the view */
+	bool HasVisibleToonMeshes(const FViewInfo& View) const;
 
-	/** Render Toon Pass */
-	void RenderToonPass(
+	/** Whether any view has a visible toon mesh element, the toon passes and lights are skipped otherwise */
+	bool HasAnyVisibleToonMeshes() const;
+
+	/** Render the toon outline and toon passes, both drawn in one raster pass per view over the base pass targets */
+	void RenderToonMeshPasses(
 		FRDGBuilder& GraphBuilder,
 		FInstanceCullingManager& InstanceCullingManager,
 		FSortedLightSetSceneInfo& SortedLightSet,
 		FSceneTextures& SceneTextures,
-		FExclusiveDepthStencil::Type BasePassDepthStencilAccess);
+		const FDBufferTextures& DBufferTextures);
+
+	/** Classify the screen tiles covered by toon pixels so toon lighting only draws over those */
+	void RenderToonTileClassification(
+		FRDGBuilder& GraphBuilder,
+		const FSceneTextures& SceneTextures);
 
-	/** Render Toon Lighting Pass */
+	/** Toon tiles of the given view and the eye it has in them, nullptr when the view was not classified */
+	const FToonLightTiles* GetToonLightTiles(const FViewInfo& View, uint32& OutEyeIndex) const;
+
+	/** Render Toon Lighting Pass, shadowed by the light's screen shadow mask or its virtual shadow map mask bits */
 	void RenderToonLight(
 		FRDGBuilder& GraphBuilder,
 		const FScene* SceneData,
 		const FViewInfo& View,
 		const FMinimalSceneTextures& SceneTextures,
 		const FLightSceneInfo* LightSceneInfo,
-		const TCHAR* ShaderName);
+		FRDGTextureRef ScreenShadowMaskTexture,
+		const TCHAR* ShaderName,
+		TRDGUniformBufferRef<FVirtualShadowMapUniformParameters> VirtualShadowMapUniformBuffer = nullptr,
+		FRDGTextureRef ShadowMaskBits = nullptr,
+		int32 VirtualShadowMapId = INDEX_NONE);
+
+	/** Marks the sorted lights from FirstLightIndex on that reach a visible toon primitive of the view */
+	void GatherToonLights(
+		const FViewInfo& View,
+		const FSortedLightSetSceneInfo& SortedLightSet,
+		int32 FirstLightIndex,
+		TBitArray<SceneRenderingBitArrayAllocator>& OutToonLights) const;
+
+	/** Whether the toon lights in the light grid can be shaded by RenderClusteredToonLights */
+	bool ShouldRenderClusteredToonLights() const;
+
+	/** Render Toon Lighting for all clustered lights in a single pass per view */
+	void RenderClusteredToonLights(
+		FRDGBuilder& GraphBuilder,
+		const FMinimalSceneTextures& SceneTextures,
+		TRDGUniformBufferRef<FVirtualShadowMapUniformParameters> VirtualShadowMapUniformBuffer,
+		FRDGTextureRef ShadowMaskBits);
+
+	/** Render Toon Lighting for all simple lights with one instanced draw per view */
+	void RenderSimpleToonLights(
+		FRDGBuilder& GraphBuilder,
+		const FMinimalSceneTextures& SceneTextures,
+		const FSimpleLightArray& SimpleLights);
+
+	/** Tags toon pixels in stencil right before the lights, after every pass that writes or clears the stencil since the toon pass */
+	void TagToonStencil(
+		FRDGBuilder& GraphBuilder,
+		const FSceneTextures& SceneTextures);
+
+	/** Resets the toon stencil bit once all lights are drawn, it is the shared sandbox bit which must be left at 0 after use */
+	void ClearToonStencil(
+		FRDGBuilder& GraphBuilder,
+		const FMinimalSceneTextures& SceneTextures);
+
+	/** Per view toon tiles built by RenderToonTileClassification */
+	TArray<FToonLightTiles, TInlineAllocator<2>> ToonLightTiles;
 
+	/** Compact toon attributes written by RenderToonMeshPasses, null unless ShouldWriteToonCompactAttributes and toon meshes are visible */
+	FRDGTextureRef ToonAttributesTexture = nullptr;
 
 
 	/**
@@ -29,6 +29,7 @@
 #include "RenderCore.h"
 #include "BasePassRendering.h"
 #include "TranslucentLighting.h"
+#include "CustomMeshPassRendering.h"
 
 // ENABLE_DEBUG_DISCARD_PROP is used to test the lighting code by allowing to discard lights to see how performance scales
 // It ought never to be enabled in a shipping build, and is probably only really useful when woring on the shading code.
@@ -51,7 +52,7 @@ DECLARE_DWORD_COUNTER_STAT(TEXT("VSM Light Projections (Local One Pass Fast)"),
 
 extern int32 GUseTranslucentLightingVolumes;
 
-static int32 GAllowDepthBoundsTest = 1;
+int32 GAllowDepthBoundsTest = 1;
 static FAutoConsoleVariableRef CVarAllowDepthBoundsTest(
 	TEXT("r.AllowDepthBoundsTest"),
 	GAllowDepthBoundsTest,
@@ -1224,6 +1225,10 @@ void FDeferredShadingSceneRenderer::RenderLights(
 	const int32 UnbatchedLightStart = SortedLightSet.UnbatchedLightStart;
 	const int32 LumenLightStart = SortedLightSet.LumenLightStart;
 
+	// per view toon lights, shadowed ones are drawn in the unbatched loop right after their shadow projection
+	TArray<TBitArray<SceneRenderingBitArrayAllocator>, TInlineAllocator<2>> ToonLightsPerView;
+	ToonLightsPerView.SetNum(Views.Num());
+
 	FHairStrandsTransmittanceMaskData DummyTransmittanceMaskData;
 	if (bUseHairLighting && Views.Num() > 0)
 	{
@@ -1312,7 +1317,11 @@ void FDeferredShadingSceneRenderer::RenderLights(
 				TEXT("Clustered deferred shading is enabled, but lights were not injected in grid, falling back to other methods (hint 'r.LightCulling.Quality' may cause this)."));
 
 			// True if the clustered shading is enabled and the feature level is there, and that the light grid had lights injected.
-			if (ShouldUseClusteredDeferredShading() && AreLightsInLightGrid())
+			// custom toon lights begin
+			// the clustered deferred pass has no toon stencil test and would light toon pixels a second time,
+			// the stencil tested standard deferred passes take its lights while toon meshes are visible
+			// custom toon lights end
+			if (ShouldUseClusteredDeferredShading() && AreLightsInLightGrid() && !HasAnyVisibleToonMeshes())
 			{
 				// Tell the trad. deferred that the clustered deferred capable lights are taken care of.
 				// This includes the simple lights
@@ -1324,10 +1333,50 @@ void FDeferredShadingSceneRenderer::RenderLights(
 			}
 
 			// custom toon lights begin
-			for (int32 LightIndex = 0; LightIndex < SortedLights.Num(); LightIndex++)
+			// Simple lights have no LightSceneInfo, they are always handled by a dedicated path
+			int32 ToonStandardDeferredStart = SortedLightSet.SimpleLightsEnd;
+
+			if (ShouldRenderClusteredToonLights())
 			{
-				const FLightSceneInfo* LightSceneInfo = SortedLights[LightIndex].LightSceneInfo;
-				RenderToonLight(GraphBuilder, Scene, Views[0], SceneTextures, LightSceneInfo, TEXT("Light::Toon"));
+				// Lights supported by clustered deferred (including simple lights) are all in the light grid
+				ToonStandardDeferredStart = SortedLightSet.ClusteredSupportedEnd;
+
+				RenderClusteredToonLights(GraphBuilder, SceneTextures, VirtualShadowMapArray.GetUniformBuffer(), ShadowSceneRenderer->VirtualShadowMapMaskBits);
+			}
+			else if (SortedLightSet.SimpleLights.InstanceData.Num() > 0)
+			{
+				RenderSimpleToonLights(GraphBuilder, SceneTextures, SortedLightSet.SimpleLights);
+			}
+
+			for (int32 ViewIndex = 0, ViewCount = Views.Num(); ViewIndex < ViewCount; ++ViewIndex)
+			{
+				const FViewInfo& View = Views[ViewIndex];
+
+				// views without a visible toon mesh have no toon pixel to light
+				if (!HasVisibleToonMeshes(View))
+				{
+					continue;
+				}
+
+				RDG_EVENT_SCOPE_CONDITIONAL(GraphBuilder, ViewCount > 1, "View%d", ViewIndex);
+				RDG_GPU_MASK_SCOPE(GraphBuilder, View.GPUMask);
+
+				// lights reaching no visible toon primitive are dropped before any pass is added
+				GatherToonLights(View, SortedLightSet, ToonStandardDeferredStart, ToonLightsPerView[ViewIndex]);
+
+				for (TConstSetBitIterator<SceneRenderingBitArrayAllocator> It(ToonLightsPerView[ViewIndex], ToonStandardDeferredStart); It; ++It)
+				{
+					const int32 LightIndex = It.GetIndex();
+
+					// shadowed and light function lights need the shadow mask of the unbatched loop
+					if (LightIndex >= UnbatchedLightStart && LightIndex < LumenLightStart)
+					{
+						continue;
+					}
+
+					const FLightSceneInfo* LightSceneInfo = SortedLights[LightIndex].LightSceneInfo;
+					RenderToonLight(GraphBuilder, Scene, View, SceneTextures, LightSceneInfo, nullptr, TEXT("Light::Toon"));
+				}
 			}
 			// custom toon lights end
 
@@ -1966,6 +2015,14 @@ void FDeferredShadingSceneRenderer::RenderLights(
 						RDG_EVENT_SCOPE_CONDITIONAL(GraphBuilder, ViewCount > 1, "View%d", ViewIndex);
 						SCOPED_GPU_MASK(GraphBuilder.RHICmdList, View.GPUMask);
 						RenderLight(GraphBuilder, Scene, View, SceneTextures, &LightSceneInfo, VirtualShadowMapId != INDEX_NONE ? nullptr : ScreenShadowMaskTexture, LightingChannelsTexture, false /*bRenderOverlap*/, true /*bCloudShadow*/, VirtualShadowMapArray.GetUniformBuffer(), ShadowSceneRenderer->VirtualShadowMapMaskBits, VirtualShadowMapId);
+
+						// custom toon lights begin
+						// toon pixels reuse the shadow projection of the light with hard toon shadows
+						if (ToonLightsPerView[ViewIndex].IsValidIndex(LightIndex) && ToonLightsPerView[ViewIndex][LightIndex])
+						{
+							RenderToonLight(GraphBuilder, Scene, View, SceneTextures, &LightSceneInfo, VirtualShadowMapId != INDEX_NONE ? nullptr : ScreenShadowMaskTexture, TEXT("Light::Toon"), VirtualShadowMapArray.GetUniformBuffer(), ShadowSceneRenderer->VirtualShadowMapMaskBits, VirtualShadowMapId);
+						}
+						// custom toon lights end
 					}
 				}
 
@@ -1997,6 +2054,11 @@ void FDeferredShadingSceneRenderer::RenderLights(
 				}
 			}
 		}
+
+		// custom toon lights begin
+		// every light has tested the toon bit, reset it for later users of the sandbox bit
+		ClearToonStencil(GraphBuilder, SceneTextures);
+		// custom toon lights end
 	}
 }
 
@@ -2073,21 +2135,22 @@ static uint32 InternalSetBoundingGeometryDepthState(FGraphicsPipelineStateInitia
 {
 	// bCameraInsideLightGeometry = true  -> CompareFunction = Always
 	// bCameraInsideLightGeometry = false -> CompareFunction = CF_DepthNearOrEqual
+	// Toon pixels are lit by the toon lighting passes only, so the toon stencil bit must be clear
 	uint32 StencilRef = 0u;
 	if (TileType != EStrataTileType::ECount)
 	{
 		check(Strata::IsStrataEnabled());
 		switch (TileType)
 		{
-		case EStrataTileType::ESimple : StencilRef = Strata::StencilBit_Fast;    GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CompareFunction, true, CF_Equal, SO_Keep, SO_Keep, SO_Keep, true, CF_Equal, SO_Keep, SO_Keep, SO_Keep, Strata::StencilBit_Fast, 0x0>::GetRHI(); break;
-		case EStrataTileType::ESingle : StencilRef = Strata::StencilBit_Single;  GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CompareFunction, true, CF_Equal, SO_Keep, SO_Keep, SO_Keep, true, CF_Equal, SO_Keep, SO_Keep, SO_Keep, Strata::StencilBit_Single, 0x0>::GetRHI(); break;
-		case EStrataTileType::EComplex: StencilRef = Strata::StencilBit_Complex; GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CompareFunction, true, CF_Equal, SO_Keep, SO_Keep, SO_Keep, true, CF_Equal, SO_Keep, SO_Keep, SO_Keep, Strata::StencilBit_Complex, 0x0>::GetRHI(); break;
+		case EStrataTileType::ESimple : StencilRef = Strata::StencilBit_Fast;    GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CompareFunction, true, CF_Equal, SO_Keep, SO_Keep, SO_Keep, true, CF_Equal, SO_Keep, SO_Keep, SO_Keep, Strata::StencilBit_Fast | STENCIL_TOON_MASK, 0x0>::GetRHI(); break;
+		case EStrataTileType::ESingle : StencilRef = Strata::StencilBit_Single;  GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CompareFunction, true, CF_Equal, SO_Keep, SO_Keep, SO_Keep, true, CF_Equal, SO_Keep, SO_Keep, SO_Keep, Strata::StencilBit_Single | STENCIL_TOON_MASK, 0x0>::GetRHI(); break;
+		case EStrataTileType::EComplex: StencilRef = Strata::StencilBit_Complex; GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CompareFunction, true, CF_Equal, SO_Keep, SO_Keep, SO_Keep, true, CF_Equal, SO_Keep, SO_Keep, SO_Keep, Strata::StencilBit_Complex | STENCIL_TOON_MASK, 0x0>::GetRHI(); break;
 		default: check(false);
 		}
 	}
 	else
 	{
-		GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CompareFunction>::GetRHI();
+		GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CompareFunction, true, CF_Equal, SO_Keep, SO_Keep, SO_Keep, false, CF_Always, SO_Keep, SO_Keep, SO_Keep, STENCIL_TOON_MASK, 0x0>::GetRHI();
 	}
 	return StencilRef;
 }
@@ -2110,7 +2173,7 @@ static uint32 SetBoundingGeometryRasterizerAndDepthState(FGraphicsPipelineStateI
 }
 
 // Use DBT to allow work culling on shadow lights
-static void CalculateLightNearFarDepthFromBounds(const FViewInfo& View, const FSphere& LightBounds, float& NearDepth, float& FarDepth)
+void CalculateLightNearFarDepthFromBounds(const FViewInfo& View, const FSphere& LightBounds, float& NearDepth, float& FarDepth)
 {
 	const FMatrix ViewProjection = View.ViewMatrices.GetViewProjectionMatrix();
 	const FVector ViewDirection = View.GetViewDirection();
@@ -2287,7 +2350,8 @@ static void InternalRenderLight(
 			GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = GFilterVertexDeclaration.VertexDeclarationRHI;
 			GraphicsPSOInit.BoundShaderState.VertexShaderRHI = bEnableStrataTiledPass ? TileVertexShader.GetVertexShader() : VertexShader.GetVertexShader();
 			GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PixelShader.GetPixelShader();		
-			GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CF_Always>::GetRHI();
+			// Skip toon pixels, they are lit by the toon lighting passes
+			GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CF_Always, true, CF_Equal, SO_Keep, SO_Keep, SO_Keep, false, CF_Always, SO_Keep, SO_Keep, SO_Keep, STENCIL_TOON_MASK, 0x0>::GetRHI();
 			SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit, 0x0);
 
 			SetShaderParameters(RHICmdList, PixelShader, PixelShader.GetPixelShader(), PassParameters->PS);
@@ -54,6 +54,7 @@
 #include "SceneViewExtension.h"
 #include "RenderCore.h"
 #include "StaticMeshBatch.h"
+#include "CustomMeshPassRendering.h"
 #include "UnrealEngine.h"
 
 #if !UE_BUILD_SHIPPING
@@ -2784,12 +2785,25 @@ struct FRelevancePacket : public FSceneRenderingAllocatorObject<FRelevancePacket
 								}
 								else // Regular shading path
 								{
-									DrawCommandPacket.AddCommandsForMesh(PrimitiveIndex, PrimitiveSceneInfo, StaticMeshRelevance, StaticMesh, Scene, bCanCache, EMeshPass::BasePass);
 									MarkMask |= EMarkMaskBits::StaticMeshVisibilityMapMask;
 
-									DrawCommandPacket.AddCommandsForMesh(PrimitiveIndex, PrimitiveSceneInfo, StaticMeshRelevance, StaticMesh, Scene, bCanCache, EMeshPass::ToonPass);
+									// only toon materials reach the toon passes, their draw count gates the whole toon pipeline.
+									// the toon pass writes the whole GBuffer of toon meshes, so they skip the base pass.
+									// cached meshes already know it from their cached toon pass command, the material is only looked up for the rest
+									const bool bToonMesh = StaticMeshRelevance.bSupportsCachingMeshDrawCommands
+										? StaticMeshRelevance.CommandInfosMask.Get(EMeshPass::ToonPass)
+										: IsToonMeshBatch(StaticMesh, View.FeatureLevel);
 
-									DrawCommandPacket.AddCommandsForMesh(PrimitiveIndex, PrimitiveSceneInfo, StaticMeshRelevance, StaticMesh, Scene, bCanCache, EMeshPass::ToonOutlinePass);
+									if (bToonMesh)
+									{
+										DrawCommandPacket.AddCommandsForMesh(PrimitiveIndex, PrimitiveSceneInfo, StaticMeshRelevance, StaticMesh, Scene, bCanCache, EMeshPass::ToonPass);
+
+										DrawCommandPacket.AddCommandsForMesh(PrimitiveIndex, PrimitiveSceneInfo, StaticMeshRelevance, StaticMesh, Scene, bCanCache, EMeshPass::ToonOutlinePass);
+									}
+									else
+									{
+										DrawCommandPacket.AddCommandsForMesh(PrimitiveIndex, PrimitiveSceneInfo, StaticMeshRelevance, StaticMesh, Scene, bCanCache, EMeshPass::BasePass);
+									}
 
 
 									if (StaticMeshRelevance.bUseSkyMaterial)
@@ -3266,14 +3280,20 @@ void ComputeDynamicMeshRelevance(EShadingPath ShadingPath, bool bAddLightmapDens
 
 		if (ViewRelevance.bRenderInMainPass || ViewRelevance.bRenderCustomDepth)
 		{
-			PassMask.Set(EMeshPass::BasePass);
-			View.NumVisibleDynamicMeshElements[EMeshPass::BasePass] += NumElements;
-			
-			PassMask.Set(EMeshPass::ToonPass);
-			View.NumVisibleDynamicMeshElements[EMeshPass::ToonPass] += NumElements;
+			// toon meshes write their GBuffer in the toon pass instead of the base pass, the toon passes only exist for deferred shading
+			if (ShadingPath == EShadingPath::Deferred && IsToonMeshBatch(*MeshBatch.Mesh, View.FeatureLevel))
+			{
+				PassMask.Set(EMeshPass::ToonPass);
+				View.NumVisibleDynamicMeshElements[EMeshPass::ToonPass] += NumElements;
 
-			PassMask.Set(EMeshPass::ToonOutlinePass);
-			View.NumVisibleDynamicMeshElements[EMeshPass::ToonOutlinePass] += NumElements;
+				PassMask.Set(EMeshPass::ToonOutlinePass);
+				View.NumVisibleDynamicMeshElements[EMeshPass::ToonOutlinePass] += NumElements;
+			}
+			else
+			{
+				PassMask.Set(EMeshPass::BasePass);
+				View.NumVisibleDynamicMeshElements[EMeshPass::BasePass] += NumElements;
+			}
 
 			if (ViewRelevance.bUsesSkyMaterial)
 			{
@@ -4996,6 +5016,9 @@ void FSceneRenderer::ComputeViewVisibility(
 		ProcessPrimitives(View, ViewCommands);
 #endif
 
+		// must run before the pass setup tasks sort the visible commands
+		UpdateToonMeshSortKeys(View, *Scene, ViewCommands);
+
 		SetupMeshPass(View, BasePassDepthStencilAccess, ViewCommands, InstanceCullingManager);
 	}
 
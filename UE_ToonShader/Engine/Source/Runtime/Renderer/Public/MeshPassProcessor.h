@@ -1314,6 +1314,13 @@ public:
 			uint64 VertexShaderHash : 32;	// Order by vertex shader's hash.
 			uint64 PixelShaderHash : 32;	// First order by pixel shader's hash.
 		} Generic;
+
+		struct
+		{
+			uint64 VertexShaderHash		: 16; // Order by vertex shader's hash.
+			uint64 PixelShaderHash		: 32; // Order by pixel shader's hash.
+			uint64 DepthBucket			: 16; // First order front to back, zero when the toon pass is not depth sorted.
+		} Toon;
 	};
 
 	FORCEINLINE bool operator!=(FMeshDrawCommandSortKey B) const